@@ -0,0 +1,55 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte queue with a read cursor. Consuming from the front only advances the
+// cursor; the live bytes are moved back to the start of the block when the
+// space wasted in front is at least as large as what has to be moved, so
+// compaction stays amortized O(1) per byte.
+struct Buffer
+{
+  uint8_t *bufferBegin = NULL;
+  uint8_t *bufferEnd = NULL;
+  uint8_t *dataBegin = NULL;
+  uint8_t *dataEnd = NULL;
+
+  Buffer() = default;
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+  ~Buffer();
+};
+
+inline uint8_t *BufferData(Buffer *buf)
+{
+  return buf->dataBegin;
+}
+
+inline size_t BufferSize(const Buffer *buf)
+{
+  return (size_t)(buf->dataEnd - buf->dataBegin);
+}
+
+inline size_t BufferCapacity(const Buffer *buf)
+{
+  return (size_t)(buf->bufferEnd - buf->bufferBegin);
+}
+
+// Free space after the data, written through BufferTail() then BufferCommit().
+inline size_t BufferRoom(const Buffer *buf)
+{
+  return (size_t)(buf->bufferEnd - buf->dataEnd);
+}
+
+inline uint8_t *BufferTail(Buffer *buf)
+{
+  return buf->dataEnd;
+}
+
+void BufferReserve(Buffer *buf, size_t len);
+void BufferCommit(Buffer *buf, size_t len);
+void BufferAppend(Buffer *buf, const void *data, size_t len);
+void BufferConsume(Buffer *buf, size_t len);
+void BufferTruncate(Buffer *buf, size_t len);
+void BufferShrink(Buffer *buf, size_t capacity);
+void BufferSwap(Buffer *a, Buffer *b);
+void BufferFree(Buffer *buf);
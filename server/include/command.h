@@ -0,0 +1,133 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <strings.h>
+#include <string_view>
+#include <vector>
+
+#include "outgoing.h"
+
+enum
+{
+  CMD_READONLY = 1,
+  CMD_WRITE = 2,
+  CMD_SLOW = 4,
+  // Runs on every shard and merges the partial replies.
+  CMD_ALL_SHARDS = 8,
+  // Runs on the shard named by the scan cursor in argument 1.
+  CMD_CURSOR = 16,
+};
+
+typedef void (*CommandHandler)(std::vector<std::string_view> &cmd, Outgoing &buf);
+// Appends one shard's array elements and returns how many.
+typedef uint32_t (*CommandPart)(std::vector<std::string_view> &cmd, Outgoing &buf);
+
+// One entry of the command registry. Arity counts the name itself; a
+// negative arity means "at least -arity arguments".
+struct Command
+{
+  const char *name = NULL;
+  int32_t arity = 0;
+  CommandHandler handler = NULL;
+  uint32_t flags = 0;
+  // Argument index of the key that picks the owning shard, 0 for none.
+  uint32_t firstKey = 0;
+  // Replaces handler for commands whose reply is an array merged across
+  // shards (CMD_ALL_SHARDS).
+  CommandPart part = NULL;
+};
+
+struct CommandStats
+{
+  uint64_t calls = 0;
+  uint64_t errors = 0;
+  uint64_t rejected = 0;
+};
+
+inline bool CommandArityOk(const Command *command, size_t argc)
+{
+  return command->arity >= 0 ? argc == (size_t)command->arity
+                             : argc >= (size_t)-command->arity;
+}
+
+constexpr char commandLower(char c)
+{
+  return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+constexpr size_t commandNameLen(const char *s)
+{
+  size_t len = 0;
+  while (s[len])
+  {
+    len++;
+  }
+  return len;
+}
+
+// FNV-1a over the lowercased name, perturbed by seed.
+constexpr uint32_t CommandHash(const char *s, size_t len, uint32_t seed)
+{
+  uint32_t h = 0x811C9DC5 ^ (seed * 0x9E3779B9);
+  for (size_t i = 0; i < len; i++)
+  {
+    h = (h ^ (uint8_t)commandLower(s[i])) * 0x01000193;
+  }
+  return h ^ (h >> 15);
+}
+
+// Collision-free slot table for a fixed set of names, searched for at
+// compile time: each name owns one slot, holding its index + 1.
+template <size_t N, size_t Slots>
+struct CommandIndex
+{
+  static_assert((Slots & (Slots - 1)) == 0, "Slots must be a power of two");
+  uint32_t seed = 0;
+  uint8_t slot[Slots] = {};
+};
+
+template <size_t Slots, size_t N>
+constexpr CommandIndex<N, Slots> CommandIndexBuild(const Command (&table)[N])
+{
+  static_assert(N < 255, "slot entries are uint8_t");
+  CommandIndex<N, Slots> index;
+  for (uint32_t seed = 1; seed < 100000; seed++)
+  {
+    for (size_t i = 0; i < Slots; i++)
+    {
+      index.slot[i] = 0;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < N && ok; i++)
+    {
+      const char *name = table[i].name;
+      size_t pos = CommandHash(name, commandNameLen(name), seed) & (Slots - 1);
+      ok = index.slot[pos] == 0;
+      index.slot[pos] = (uint8_t)(i + 1);
+    }
+    if (ok)
+    {
+      index.seed = seed;
+      return index;
+    }
+  }
+  return index;
+}
+
+// One hash, one slot load and one case-insensitive compare.
+template <size_t N, size_t Slots>
+const Command *CommandLookup(const Command (&table)[N], const CommandIndex<N, Slots> &index, std::string_view name)
+{
+  uint32_t pos = CommandHash(name.data(), name.size(), index.seed) & (Slots - 1);
+  uint8_t id = index.slot[pos];
+  if (id == 0)
+  {
+    return NULL;
+  }
+  const Command *command = &table[id - 1];
+  if (commandNameLen(command->name) != name.size() || strncasecmp(command->name, name.data(), name.size()) != 0)
+  {
+    return NULL;
+  }
+  return command;
+}
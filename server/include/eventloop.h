@@ -0,0 +1,55 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+#include <vector>
+
+enum
+{
+  EVENT_LOOP_POLL = 0,
+  EVENT_LOOP_EPOLL,
+  EVENT_LOOP_EPOLL_ET,
+};
+
+enum
+{
+  EVENT_READ = 1,
+  EVENT_WRITE = 2,
+  EVENT_ERROR = 4,
+};
+
+struct Event
+{
+  int fd = -1;
+  uint32_t events = 0;
+};
+
+// Readiness notification over a persistent interest list. Callers register a
+// fd once and only report changes, so a wakeup costs O(ready) with epoll
+// instead of O(registered).
+struct EventLoop
+{
+  int backend = EVENT_LOOP_POLL;
+  int epfd = -1;
+
+  // poll() fallback keeps its pollfd array across iterations.
+  std::vector<struct pollfd> pollArgs;
+  std::vector<int32_t> fd2pos;
+
+  std::vector<Event> ready;
+};
+
+bool EventLoopInit(EventLoop *loop, int backend);
+void EventLoopAdd(EventLoop *loop, int fd, uint32_t events);
+void EventLoopModify(EventLoop *loop, int fd, uint32_t events);
+void EventLoopDelete(EventLoop *loop, int fd);
+int EventLoopWait(EventLoop *loop, int32_t timeoutMS);
+void EventLoopClose(EventLoop *loop);
+
+bool EventLoopParseBackend(const char *name, int *backend);
+const char *EventLoopBackendName(int backend);
+
+inline bool EventLoopEdgeTriggered(EventLoop *loop)
+{
+  return loop->backend == EVENT_LOOP_EPOLL_ET;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <string_view>
+
+// Redis-style glob: `*` any run, `?` any byte, `[abc]`, `[^a-z]` classes
+// and `\` escapes. Matching is bytewise and case-sensitive.
+bool GlobMatch(std::string_view pattern, std::string_view s);
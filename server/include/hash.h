@@ -0,0 +1,89 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// 64-bit string hash in the style of wyhash: 8-byte reads folded with
+// 64x64->128-bit multiplies, three independent lanes for long inputs so
+// the multiplies overlap, and a seed mixed into every step. Keys longer
+// than 16 bytes cost roughly one multiply per 16 bytes.
+
+// Per-process seed for stringHash(); see HashSeedInit().
+inline uint64_t gHashSeed = 0;
+
+const uint64_t kHashSecret[4] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull};
+
+inline uint64_t hashMum(uint64_t a, uint64_t b)
+{
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+inline uint64_t hashRead64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+inline uint64_t hashRead32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint64_t HashBytes(const void *data, size_t len, uint64_t seed)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  seed ^= hashMum(seed ^ kHashSecret[0], kHashSecret[1]);
+  uint64_t a = 0;
+  uint64_t b = 0;
+  if (len <= 16)
+  {
+    if (len >= 4)
+    {
+      // Two overlapping pairs of 4-byte reads cover 4..16 bytes.
+      size_t mid = (len >> 3) << 2;
+      a = (hashRead32(p) << 32) | hashRead32(p + mid);
+      b = (hashRead32(p + len - 4) << 32) | hashRead32(p + len - 4 - mid);
+    }
+    else if (len > 0)
+    {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    }
+  }
+  else
+  {
+    size_t left = len;
+    if (left > 48)
+    {
+      uint64_t lane1 = seed;
+      uint64_t lane2 = seed;
+      do
+      {
+        seed = hashMum(hashRead64(p) ^ kHashSecret[1], hashRead64(p + 8) ^ seed);
+        lane1 = hashMum(hashRead64(p + 16) ^ kHashSecret[2], hashRead64(p + 24) ^ lane1);
+        lane2 = hashMum(hashRead64(p + 32) ^ kHashSecret[3], hashRead64(p + 40) ^ lane2);
+        p += 48;
+        left -= 48;
+      } while (left > 48);
+      seed ^= lane1 ^ lane2;
+    }
+    while (left > 16)
+    {
+      seed = hashMum(hashRead64(p) ^ kHashSecret[1], hashRead64(p + 8) ^ seed);
+      p += 16;
+      left -= 16;
+    }
+    // The last 16 bytes, overlapping what was already consumed.
+    a = hashRead64(p + left - 16);
+    b = hashRead64(p + left - 8);
+  }
+  __uint128_t r = (__uint128_t)(a ^ kHashSecret[1]) * (b ^ seed);
+  return hashMum((uint64_t)r ^ kHashSecret[0] ^ len, (uint64_t)(r >> 64) ^ kHashSecret[1]);
+}
+
+// Seeds from the kernel so that which keys collide differs per process.
+void HashSeedInit();
@@ -2,30 +2,71 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "doublelinklist.h"
+
 struct HNode
 {
   HNode *next = NULL;
   uint64_t hcode = 0;
 };
 
+enum
+{
+  // Buckets of intrusive chains.
+  HMAP_CHAINED = 0,
+  // Open addressing with SIMD-probed control bytes; see swisstable.cpp.
+  HMAP_SWISS,
+};
+
 struct HTab
 {
+  // Chain heads, or for HMAP_SWISS one node pointer per slot.
   HNode **bucket = NULL;
   size_t mask = 0;
   size_t size = 0;
+  // HMAP_SWISS only: a control byte per slot, and deleted slots.
+  uint8_t *ctrl = NULL;
+  size_t tombstones = 0;
 };
 
+// Both engines resize incrementally: a bounded amount of migration from
+// `older` to `newer` rides along with each operation, and the event loop
+// moves the rest while idle through HashMapRehashBackground().
 struct HMap
 {
   HTab newer;
   HTab older;
   size_t migrate_pos = 0;
+  // Picked before the first insert and kept across HashMapClear().
+  uint32_t engine = HMAP_CHAINED;
+  // On the queue of the thread that started the resize until it finishes.
+  DList queued;
 };
 
+// Migration work, in moved nodes plus scanned buckets, that each operation
+// does on the map it touches.
+inline thread_local size_t gHashMapStepWork = 128;
+
 HNode *HashMapLookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void HashMapInsert(HMap *hmap, HNode *key);
 HNode *HashMapDelete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
 void HashMapClear(HMap *hmap);
 size_t HashMapSize(HMap *hmap);
 
-void HashMapForEach(HMap *hmap, bool (*f)(HNode *, void *), void *arg);
\ No newline at end of file
+void HashMapForEach(HMap *hmap, bool (*f)(HNode *, void *), void *arg);
+// Visits the nodes of the home buckets named by cursor and returns the next
+// cursor, 0 once the scan that started at 0 is complete. The cursor counts
+// in reversed bit order, so buckets split or merged by a resize in between
+// are neither skipped nor revisited wholesale: a node present for the whole
+// scan is visited at least once, possibly twice. f must not modify the map.
+uint64_t HashMapScan(HMap *hmap, uint64_t cursor, void (*f)(HNode *, void *), void *arg);
+
+// Migrates up to `work` units across the maps this thread is resizing.
+// Returns the work done; less than asked means nothing is left.
+size_t HashMapRehashBackground(size_t work);
+bool HashMapRehashPending();
+// Takes hmap off this thread's queue, before another thread clears it.
+void HashMapDequeue(HMap *hmap);
+
+bool HashMapParseEngine(const char *name, uint32_t *engine);
+const char *HashMapEngineName(uint32_t engine);
\ No newline at end of file
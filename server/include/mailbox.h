@@ -0,0 +1,69 @@
+#pragma once
+#include <stddef.h>
+#include <atomic>
+
+// Intrusive multi-producer single-consumer queue (Vyukov). Any thread may
+// push; only the owning thread pops. No locks are taken on either side.
+struct MailboxNode
+{
+  std::atomic<MailboxNode *> next{NULL};
+};
+
+struct Mailbox
+{
+  std::atomic<MailboxNode *> head{NULL};
+  MailboxNode *tail = NULL;
+  MailboxNode stub;
+};
+
+inline void MailboxInit(Mailbox *box)
+{
+  box->stub.next.store(NULL, std::memory_order_relaxed);
+  box->head.store(&box->stub, std::memory_order_relaxed);
+  box->tail = &box->stub;
+}
+
+inline void MailboxPush(Mailbox *box, MailboxNode *node)
+{
+  node->next.store(NULL, std::memory_order_relaxed);
+  MailboxNode *prev = box->head.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+// Returns NULL when empty, or when a producer is halfway through a push; the
+// node becomes visible on a later call.
+inline MailboxNode *MailboxPop(Mailbox *box)
+{
+  MailboxNode *tail = box->tail;
+  MailboxNode *next = tail->next.load(std::memory_order_acquire);
+  if (tail == &box->stub)
+  {
+    if (!next)
+    {
+      return NULL;
+    }
+    box->tail = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+
+  if (next)
+  {
+    box->tail = next;
+    return tail;
+  }
+
+  if (tail != box->head.load(std::memory_order_acquire))
+  {
+    return NULL;
+  }
+
+  MailboxPush(box, &box->stub);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next)
+  {
+    box->tail = next;
+    return tail;
+  }
+  return NULL;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "buffer.h"
+#include "value.h"
+
+// A reference to a Value's bytes, spliced into the reply stream before the
+// inline byte at stream position `at`.
+struct Splice
+{
+  uint64_t at = 0;
+  Value *value = NULL;
+};
+
+// Reply bytes waiting to be sent: small items are copied into `data`, large
+// values are referenced through splices and reach the socket via writev()
+// without being copied. Positions count inline bytes since the stream began,
+// so they survive consuming from the front.
+struct Outgoing
+{
+  Buffer data;
+  // Pending splices are splices[head..]; the vector is reset once drained.
+  std::vector<Splice> splices;
+  size_t head = 0;
+  // Bytes of splices[head..], including what was sent of the first.
+  size_t splicedBytes = 0;
+  uint64_t consumed = 0;
+  // Bytes of splices[head] already sent.
+  size_t sentOfFront = 0;
+
+  Outgoing() = default;
+  Outgoing(const Outgoing &) = delete;
+  Outgoing &operator=(const Outgoing &) = delete;
+  ~Outgoing();
+};
+
+inline bool OutgoingEmpty(const Outgoing *out)
+{
+  return BufferSize(&out->data) == 0 && out->head == out->splices.size();
+}
+
+// Bytes not yet sent.
+inline size_t OutgoingSize(const Outgoing *out)
+{
+  return BufferSize(&out->data) + out->splicedBytes - out->sentOfFront;
+}
+
+void OutgoingSplice(Outgoing *out, Value *value);
+size_t OutgoingSplicedSince(const Outgoing *out, size_t pos);
+void OutgoingTruncate(Outgoing *out, size_t len);
+void OutgoingMove(Outgoing *dst, Outgoing *src);
+size_t OutgoingIovecs(Outgoing *out, struct iovec *iov, size_t max);
+void OutgoingConsume(Outgoing *out, size_t len);
+void OutgoingSwap(Outgoing *a, Outgoing *b);
+void OutgoingClear(Outgoing *out);
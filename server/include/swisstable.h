@@ -0,0 +1,19 @@
+#pragma once
+#include "hashtable.h"
+
+// The HMAP_SWISS engine behind the HashMap* functions.
+HNode *SwissLookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
+void SwissInsert(HMap *hmap, HNode *node);
+HNode *SwissDelete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *));
+void SwissClear(HMap *hmap);
+void SwissForEach(HMap *hmap, bool (*f)(HNode *, void *), void *arg);
+// Home groups for HashMapScan(): slot groups indexed by the low hash bits,
+// each standing for the nodes whose probe sequence starts there.
+size_t SwissHomeMask(HTab *htab);
+void SwissScanHome(HTab *htab, size_t group, void (*f)(HNode *, void *), void *arg);
+// Returns the work done, like HashMapRehashBackground().
+size_t SwissHelpRehashing(HMap *hmap, size_t work);
+
+// Shared by both engines: a map joins the background queue when it starts
+// a resize and leaves when older is released.
+void HashMapEnqueue(HMap *hmap);
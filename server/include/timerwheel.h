@@ -0,0 +1,52 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "doublelinklist.h"
+
+const uint32_t kWheelBits = 6;
+const uint32_t kWheelSlots = 1 << kWheelBits;
+// Enough levels to cover any 64-bit millisecond deadline.
+const uint32_t kWheelLevels = (64 + kWheelBits - 1) / kWheelBits;
+
+// Embedded in the object it times. Unlinked (link.next == NULL) while not
+// scheduled.
+struct TimerNode
+{
+  DList link;
+  uint64_t expireAt = 0;
+};
+
+// Hierarchical timing wheel with millisecond ticks. A timer sits at the
+// level of the highest 6-bit group in which its deadline differs from the
+// current tick, and drops to lower levels as the wheel reaches its slot, so
+// insert, cancel and reschedule are O(1) and timers fire at their exact
+// millisecond.
+struct TimerWheel
+{
+  // Next tick to process; every timer before it has been moved to `due`.
+  uint64_t now = 0;
+  size_t count = 0;
+  // Bit i set when slots[level][i] may be non-empty; cleared lazily.
+  uint64_t occupied[kWheelLevels] = {};
+  DList slots[kWheelLevels][kWheelSlots];
+  // Expired timers not yet handed out by TimerWheelPop().
+  DList due;
+};
+
+inline bool TimerArmed(const TimerNode *node)
+{
+  return node->link.next != NULL;
+}
+
+void TimerWheelInit(TimerWheel *wheel, uint64_t nowMS);
+// Schedules node at expireAt, moving it if it was already scheduled.
+void TimerWheelAdd(TimerWheel *wheel, TimerNode *node, uint64_t expireAt);
+void TimerWheelCancel(TimerWheel *wheel, TimerNode *node);
+// Unlinks and returns one timer with expireAt <= nowMS, or NULL. Callers
+// bound the work per tick by how many they pop.
+TimerNode *TimerWheelPop(TimerWheel *wheel, uint64_t nowMS);
+// Earliest time the wheel needs attention: a deadline, or a cascade from a
+// higher level, which never comes later than the deadlines it holds.
+// UINT64_MAX when empty.
+uint64_t TimerWheelNextMS(const TimerWheel *wheel);
@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring binding over the raw syscalls: one submission and
+// completion ring plus a kernel-registered ring of provided receive buffers.
+struct IoUring
+{
+  int fd = -1;
+  uint32_t features = 0;
+
+  void *sqRing = NULL;
+  size_t sqRingSize = 0;
+  unsigned *sqHead = NULL;
+  unsigned *sqTail = NULL;
+  unsigned *sqMask = NULL;
+  unsigned *sqArray = NULL;
+  io_uring_sqe *sqes = NULL;
+  size_t sqesSize = 0;
+  unsigned sqLocalTail = 0;
+  unsigned toSubmit = 0;
+
+  void *cqRing = NULL;
+  size_t cqRingSize = 0;
+  unsigned *cqHead = NULL;
+  unsigned *cqTail = NULL;
+  unsigned *cqMask = NULL;
+  io_uring_cqe *cqes = NULL;
+
+  io_uring_buf_ring *bufRing = NULL;
+  size_t bufRingSize = 0;
+  uint8_t *bufBase = NULL;
+  size_t bufSize = 0;
+  uint16_t bufCount = 0;
+  uint16_t bufGroup = 0;
+  uint16_t bufTail = 0;
+};
+
+bool IoUringInit(IoUring *ring, unsigned entries);
+bool IoUringSetupBuffers(IoUring *ring, uint16_t count, size_t size, uint16_t group);
+void IoUringClose(IoUring *ring);
+
+io_uring_sqe *IoUringGetSqe(IoUring *ring);
+int IoUringSubmit(IoUring *ring);
+int IoUringSubmitAndWait(IoUring *ring, int32_t timeoutMS);
+io_uring_cqe *IoUringPeekCqe(IoUring *ring);
+void IoUringCqeSeen(IoUring *ring);
+
+uint8_t *IoUringBuffer(IoUring *ring, uint16_t bid);
+void IoUringRecycleBuffer(IoUring *ring, uint16_t bid);
+
+void IoUringPrepAcceptMultishot(io_uring_sqe *sqe, int fd);
+void IoUringPrepRecvMultishot(io_uring_sqe *sqe, int fd, uint16_t group);
+void IoUringPrepSendmsg(io_uring_sqe *sqe, int fd, const struct msghdr *msg);
+void IoUringPrepCancel(io_uring_sqe *sqe, uint64_t userData);
+void IoUringPrepRead(io_uring_sqe *sqe, int fd, void *buf, size_t len);
@@ -0,0 +1,27 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Refcounted string payload. The owning Entry holds one reference and every
+// reply that splices the bytes in holds another, so a later write to the key
+// allocates a fresh Value instead of touching bytes still being sent. The
+// count is atomic because forwarded replies are released on another shard.
+struct Value
+{
+  std::atomic<uint32_t> refs{1};
+  size_t len = 0;
+  size_t cap = 0;
+  char data[0];
+};
+
+Value *ValueNew(const char *data, size_t len);
+Value *ValueAssign(Value *value, const char *data, size_t len);
+
+inline Value *ValueRef(Value *value)
+{
+  value->refs.fetch_add(1, std::memory_order_relaxed);
+  return value;
+}
+
+void ValueRelease(Value *value);
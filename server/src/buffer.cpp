@@ -0,0 +1,124 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+#include "buffer.h"
+
+const size_t kBufferMinCapacity = 256;
+
+Buffer::~Buffer()
+{
+  BufferFree(this);
+}
+
+static void bufferRealloc(Buffer *buf, size_t capacity)
+{
+  size_t size = BufferSize(buf);
+  assert(capacity >= size);
+  uint8_t *block = (uint8_t *)malloc(capacity);
+  if (!block)
+  {
+    abort();
+  }
+  if (size > 0)
+  {
+    memcpy(block, buf->dataBegin, size);
+  }
+  free(buf->bufferBegin);
+  buf->bufferBegin = block;
+  buf->bufferEnd = block + capacity;
+  buf->dataBegin = block;
+  buf->dataEnd = block + size;
+}
+
+// Makes room for at least len more bytes after the data.
+void BufferReserve(Buffer *buf, size_t len)
+{
+  if (BufferRoom(buf) >= len)
+  {
+    return;
+  }
+
+  size_t size = BufferSize(buf);
+  size_t front = (size_t)(buf->dataBegin - buf->bufferBegin);
+  if (front + BufferRoom(buf) >= len && front >= size)
+  {
+    memmove(buf->bufferBegin, buf->dataBegin, size);
+    buf->dataBegin = buf->bufferBegin;
+    buf->dataEnd = buf->bufferBegin + size;
+    return;
+  }
+
+  size_t capacity = BufferCapacity(buf) * 2;
+  if (capacity < size + len)
+  {
+    capacity = size + len;
+  }
+  if (capacity < kBufferMinCapacity)
+  {
+    capacity = kBufferMinCapacity;
+  }
+  bufferRealloc(buf, capacity);
+}
+
+void BufferCommit(Buffer *buf, size_t len)
+{
+  assert(len <= BufferRoom(buf));
+  buf->dataEnd += len;
+}
+
+void BufferAppend(Buffer *buf, const void *data, size_t len)
+{
+  if (len == 0)
+  {
+    return;
+  }
+  BufferReserve(buf, len);
+  memcpy(buf->dataEnd, data, len);
+  buf->dataEnd += len;
+}
+
+void BufferConsume(Buffer *buf, size_t len)
+{
+  assert(len <= BufferSize(buf));
+  buf->dataBegin += len;
+  if (buf->dataBegin == buf->dataEnd)
+  {
+    // Empty: rewind for free instead of waiting for a compaction.
+    buf->dataBegin = buf->dataEnd = buf->bufferBegin;
+  }
+}
+
+// Keeps only the first len bytes.
+void BufferTruncate(Buffer *buf, size_t len)
+{
+  assert(len <= BufferSize(buf));
+  buf->dataEnd = buf->dataBegin + len;
+}
+
+// Gives memory back once the buffer has grown past capacity, keeping the
+// data and a block of that size.
+void BufferShrink(Buffer *buf, size_t capacity)
+{
+  if (BufferCapacity(buf) <= capacity)
+  {
+    return;
+  }
+  size_t size = BufferSize(buf);
+  bufferRealloc(buf, size > capacity ? size : capacity);
+}
+
+void BufferSwap(Buffer *a, Buffer *b)
+{
+  std::swap(a->bufferBegin, b->bufferBegin);
+  std::swap(a->bufferEnd, b->bufferEnd);
+  std::swap(a->dataBegin, b->dataBegin);
+  std::swap(a->dataEnd, b->dataEnd);
+}
+
+void BufferFree(Buffer *buf)
+{
+  free(buf->bufferBegin);
+  buf->bufferBegin = buf->bufferEnd = buf->dataBegin = buf->dataEnd = NULL;
+}
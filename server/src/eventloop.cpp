@@ -0,0 +1,226 @@
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "eventloop.h"
+
+const size_t kMaxEpollEvents = 1024;
+
+static uint32_t toEpoll(EventLoop *loop, uint32_t events)
+{
+  uint32_t out = 0;
+  if (events & EVENT_READ)
+  {
+    out |= EPOLLIN;
+  }
+  if (events & EVENT_WRITE)
+  {
+    out |= EPOLLOUT;
+  }
+  if (EventLoopEdgeTriggered(loop))
+  {
+    out |= EPOLLET;
+  }
+  return out;
+}
+
+static short toPoll(uint32_t events)
+{
+  short out = POLLERR;
+  if (events & EVENT_READ)
+  {
+    out |= POLLIN;
+  }
+  if (events & EVENT_WRITE)
+  {
+    out |= POLLOUT;
+  }
+  return out;
+}
+
+bool EventLoopInit(EventLoop *loop, int backend)
+{
+  loop->backend = backend;
+  if (backend == EVENT_LOOP_POLL)
+  {
+    return true;
+  }
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epfd < 0)
+  {
+    loop->backend = EVENT_LOOP_POLL;
+    return false;
+  }
+  return true;
+}
+
+void EventLoopAdd(EventLoop *loop, int fd, uint32_t events)
+{
+  if (loop->backend == EVENT_LOOP_POLL)
+  {
+    if (loop->fd2pos.size() <= (size_t)fd)
+    {
+      loop->fd2pos.resize(fd + 1, -1);
+    }
+    assert(loop->fd2pos[fd] < 0);
+    loop->fd2pos[fd] = (int32_t)loop->pollArgs.size();
+    loop->pollArgs.push_back(pollfd{fd, toPoll(events), 0});
+    return;
+  }
+
+  struct epoll_event ev = {};
+  ev.events = toEpoll(loop, events);
+  ev.data.fd = fd;
+  int rv = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+  assert(rv == 0);
+  (void)rv;
+}
+
+void EventLoopModify(EventLoop *loop, int fd, uint32_t events)
+{
+  if (loop->backend == EVENT_LOOP_POLL)
+  {
+    assert(loop->fd2pos[fd] >= 0);
+    loop->pollArgs[loop->fd2pos[fd]].events = toPoll(events);
+    return;
+  }
+
+  // Re-arming also re-queues a fd that is already ready, so edge-triggered
+  // mode does not lose the readiness it had while the interest was off.
+  struct epoll_event ev = {};
+  ev.events = toEpoll(loop, events);
+  ev.data.fd = fd;
+  int rv = epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+  assert(rv == 0);
+  (void)rv;
+}
+
+void EventLoopDelete(EventLoop *loop, int fd)
+{
+  if (loop->backend == EVENT_LOOP_POLL)
+  {
+    int32_t pos = loop->fd2pos[fd];
+    assert(pos >= 0);
+    loop->pollArgs[pos] = loop->pollArgs.back();
+    loop->fd2pos[loop->pollArgs[pos].fd] = pos;
+    loop->pollArgs.pop_back();
+    loop->fd2pos[fd] = -1;
+    return;
+  }
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int pollWait(EventLoop *loop, int32_t timeoutMS)
+{
+  int rv = poll(loop->pollArgs.data(), (nfds_t)loop->pollArgs.size(), timeoutMS);
+  if (rv <= 0)
+  {
+    return rv;
+  }
+
+  for (const struct pollfd &pfd : loop->pollArgs)
+  {
+    if (!pfd.revents)
+    {
+      continue;
+    }
+
+    Event ev;
+    ev.fd = pfd.fd;
+    if (pfd.revents & POLLIN)
+    {
+      ev.events |= EVENT_READ;
+    }
+    if (pfd.revents & POLLOUT)
+    {
+      ev.events |= EVENT_WRITE;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+    {
+      ev.events |= EVENT_ERROR;
+    }
+    loop->ready.push_back(ev);
+  }
+  return (int)loop->ready.size();
+}
+
+static int epollWait(EventLoop *loop, int32_t timeoutMS)
+{
+  struct epoll_event events[kMaxEpollEvents];
+  int rv = epoll_wait(loop->epfd, events, kMaxEpollEvents, timeoutMS);
+  if (rv <= 0)
+  {
+    return rv;
+  }
+
+  for (int i = 0; i < rv; i++)
+  {
+    Event ev;
+    ev.fd = events[i].data.fd;
+    if (events[i].events & EPOLLIN)
+    {
+      ev.events |= EVENT_READ;
+    }
+    if (events[i].events & EPOLLOUT)
+    {
+      ev.events |= EVENT_WRITE;
+    }
+    if (events[i].events & (EPOLLERR | EPOLLHUP))
+    {
+      ev.events |= EVENT_ERROR;
+    }
+    loop->ready.push_back(ev);
+  }
+  return rv;
+}
+
+int EventLoopWait(EventLoop *loop, int32_t timeoutMS)
+{
+  loop->ready.clear();
+  if (loop->backend == EVENT_LOOP_POLL)
+  {
+    return pollWait(loop, timeoutMS);
+  }
+  return epollWait(loop, timeoutMS);
+}
+
+void EventLoopClose(EventLoop *loop)
+{
+  if (loop->epfd >= 0)
+  {
+    close(loop->epfd);
+  }
+  *loop = EventLoop{};
+}
+
+bool EventLoopParseBackend(const char *name, int *backend)
+{
+  for (int i = EVENT_LOOP_POLL; i <= EVENT_LOOP_EPOLL_ET; i++)
+  {
+    if (strcmp(name, EventLoopBackendName(i)) == 0)
+    {
+      *backend = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *EventLoopBackendName(int backend)
+{
+  switch (backend)
+  {
+  case EVENT_LOOP_POLL:
+    return "poll";
+  case EVENT_LOOP_EPOLL:
+    return "epoll";
+  case EVENT_LOOP_EPOLL_ET:
+    return "epoll-et";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,97 @@
+#include <utility>
+#include "globmatch.h"
+
+// Matches the pattern element at p against c and sets *next past it.
+static bool matchOne(std::string_view pattern, size_t p, char c, size_t *next)
+{
+  if (pattern[p] == '?')
+  {
+    *next = p + 1;
+    return true;
+  }
+  if (pattern[p] == '\\' && p + 1 < pattern.size())
+  {
+    *next = p + 2;
+    return pattern[p + 1] == c;
+  }
+  if (pattern[p] != '[')
+  {
+    *next = p + 1;
+    return pattern[p] == c;
+  }
+
+  // A class runs to the next unescaped `]`, or to the end of the pattern.
+  p++;
+  bool negate = p < pattern.size() && pattern[p] == '^';
+  if (negate)
+  {
+    p++;
+  }
+  bool found = false;
+  while (p < pattern.size() && pattern[p] != ']')
+  {
+    if (pattern[p] == '\\' && p + 1 < pattern.size())
+    {
+      found |= pattern[p + 1] == c;
+      p += 2;
+    }
+    else if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']')
+    {
+      unsigned char lo = (unsigned char)pattern[p];
+      unsigned char hi = (unsigned char)pattern[p + 2];
+      if (lo > hi)
+      {
+        std::swap(lo, hi);
+      }
+      found |= (unsigned char)c >= lo && (unsigned char)c <= hi;
+      p += 3;
+    }
+    else
+    {
+      found |= pattern[p] == c;
+      p++;
+    }
+  }
+  *next = p < pattern.size() ? p + 1 : p;
+  return found != negate;
+}
+
+// Backtracks only to the most recent `*`: letting an earlier star absorb
+// more can never help once a later one has matched, so the worst case is
+// len(pattern) * len(s) steps rather than exponential.
+bool GlobMatch(std::string_view pattern, std::string_view s)
+{
+  const size_t kNone = (size_t)-1;
+  size_t p = 0;
+  size_t i = 0;
+  size_t starP = kNone;
+  size_t starI = 0;
+  while (i < s.size())
+  {
+    size_t next = 0;
+    if (p < pattern.size() && pattern[p] == '*')
+    {
+      starP = ++p;
+      starI = i;
+    }
+    else if (p < pattern.size() && matchOne(pattern, p, s[i], &next))
+    {
+      p = next;
+      i++;
+    }
+    else if (starP != kNone)
+    {
+      p = starP;
+      i = ++starI;
+    }
+    else
+    {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*')
+  {
+    p++;
+  }
+  return p == pattern.size();
+}
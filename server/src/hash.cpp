@@ -0,0 +1,17 @@
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "hash.h"
+
+void HashSeedInit()
+{
+  uint64_t seed = 0;
+  if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed))
+  {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_REALTIME, &tv);
+    seed = hashMum((uint64_t)tv.tv_nsec ^ kHashSecret[2], (uint64_t)getpid() ^ (uint64_t)tv.tv_sec);
+  }
+  gHashSeed = seed;
+}
@@ -1,9 +1,19 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <utility>
+#include "common.h"
 #include "hashtable.h"
+#include "swisstable.h"
 
-const size_t kRehashingWork = 128;
 const size_t kMaxLoadFactor = 8;
+const size_t kMinCapacity = 4;
+// Shrinks below one node per 2 buckets, to a table at load 2..4: far
+// enough from both thresholds that a keyspace hovering near one of them
+// does not bounce between sizes.
+const size_t kShrinkLoadDivisor = 2;
+const size_t kShrinkTargetLoad = 4;
+
 static void init(HTab *htab, size_t n)
 {
   assert(n > 0 && ((n - 1) & n) == 0);
@@ -62,15 +72,45 @@ static bool forEach(HTab *htab, bool (*f)(HNode *, void *), void *arg)
   return true;
 }
 
-static void HashMapHelpRehashing(HMap *hmap)
+// Maps with a resize in progress on this thread, oldest first.
+static thread_local DList gRehashQueue;
+
+static DList *rehashQueue()
+{
+  if (!gRehashQueue.next)
+  {
+    DListInit(&gRehashQueue);
+  }
+  return &gRehashQueue;
+}
+
+void HashMapEnqueue(HMap *hmap)
+{
+  assert(!hmap->queued.next);
+  DListInsertBefore(rehashQueue(), &hmap->queued);
+}
+
+void HashMapDequeue(HMap *hmap)
+{
+  if (hmap->queued.next)
+  {
+    DListDetach(&hmap->queued);
+    hmap->queued = DList{};
+  }
+}
+
+static size_t HashMapHelpRehashing(HMap *hmap, size_t work)
 {
   size_t nwork = 0;
-  while (nwork < kRehashingWork && hmap->older.size > 0)
+  while (nwork < work && hmap->older.size > 0)
   {
     HNode **from = &hmap->older.bucket[hmap->migrate_pos];
     if (!*from)
     {
+      // Empty buckets count too: a sparse table being shrunk may have
+      // long runs of them.
       hmap->migrate_pos++;
+      nwork++;
       continue;
     }
 
@@ -82,21 +122,44 @@ static void HashMapHelpRehashing(HMap *hmap)
   {
     free(hmap->older.bucket);
     hmap->older = HTab{};
+    HashMapDequeue(hmap);
   }
+  return nwork;
 }
 
-static void HashMapTriggerRehashing(HMap *hmap)
+// Moves the nodes to a table of n buckets, a bit on each operation.
+static void HashMapTriggerRehashing(HMap *hmap, size_t n)
 {
   assert(hmap->older.bucket == NULL);
 
   hmap->older = hmap->newer;
-  init(&hmap->newer, (hmap->newer.mask + 1) * 2);
+  init(&hmap->newer, n);
   hmap->migrate_pos = 0;
+  HashMapEnqueue(hmap);
+}
+
+static void HashMapMaybeShrink(HMap *hmap)
+{
+  size_t n = hmap->newer.mask + 1;
+  if (hmap->older.bucket || n <= kMinCapacity || hmap->newer.size >= n / kShrinkLoadDivisor)
+  {
+    return;
+  }
+  size_t target = kMinCapacity;
+  while (target * kShrinkTargetLoad < hmap->newer.size)
+  {
+    target *= 2;
+  }
+  HashMapTriggerRehashing(hmap, target);
 }
 
 HNode *HashMapLookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
 {
-  HashMapHelpRehashing(hmap);
+  if (hmap->engine == HMAP_SWISS)
+  {
+    return SwissLookup(hmap, key, eq);
+  }
+  HashMapHelpRehashing(hmap, gHashMapStepWork);
   HNode **from = lookup(&hmap->newer, key, eq);
   if (!from)
   {
@@ -107,9 +170,13 @@ HNode *HashMapLookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
 
 void HashMapInsert(HMap *hmap, HNode *node)
 {
+  if (hmap->engine == HMAP_SWISS)
+  {
+    return SwissInsert(hmap, node);
+  }
   if (!hmap->newer.bucket)
   {
-    init(&hmap->newer, 4);
+    init(&hmap->newer, kMinCapacity);
   }
   insert(&hmap->newer, node);
 
@@ -118,19 +185,25 @@ void HashMapInsert(HMap *hmap, HNode *node)
     size_t shreshold = (hmap->newer.mask + 1) * kMaxLoadFactor;
     if (hmap->newer.size >= shreshold)
     {
-      HashMapTriggerRehashing(hmap);
+      HashMapTriggerRehashing(hmap, (hmap->newer.mask + 1) * 2);
     }
   }
 
-  HashMapHelpRehashing(hmap);
+  HashMapHelpRehashing(hmap, gHashMapStepWork);
 }
 
 HNode *HashMapDelete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
 {
-  HashMapHelpRehashing(hmap);
+  if (hmap->engine == HMAP_SWISS)
+  {
+    return SwissDelete(hmap, key, eq);
+  }
+  HashMapHelpRehashing(hmap, gHashMapStepWork);
   if (HNode **from = lookup(&hmap->newer, key, eq))
   {
-    return detach(&hmap->newer, from);
+    HNode *node = detach(&hmap->newer, from);
+    HashMapMaybeShrink(hmap);
+    return node;
   }
   if (HNode **from = lookup(&hmap->older, key, eq))
   {
@@ -141,9 +214,19 @@ HNode *HashMapDelete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
 
 void HashMapClear(HMap *hmap)
 {
-  free(hmap->newer.bucket);
-  free(hmap->older.bucket);
+  HashMapDequeue(hmap);
+  uint32_t engine = hmap->engine;
+  if (engine == HMAP_SWISS)
+  {
+    SwissClear(hmap);
+  }
+  else
+  {
+    free(hmap->newer.bucket);
+    free(hmap->older.bucket);
+  }
   *hmap = HMap{};
+  hmap->engine = engine;
 }
 
 size_t HashMapSize(HMap *hmap)
@@ -153,5 +236,126 @@ size_t HashMapSize(HMap *hmap)
 
 void HashMapForEach(HMap *hmap, bool (*f)(HNode *, void *), void *arg)
 {
+  if (hmap->engine == HMAP_SWISS)
+  {
+    return SwissForEach(hmap, f, arg);
+  }
   forEach(&hmap->newer, f, arg) && forEach(&hmap->older, f, arg);
 }
+
+size_t HashMapRehashBackground(size_t work)
+{
+  DList *queue = rehashQueue();
+  size_t done = 0;
+  while (done < work && !DListEmpty(queue))
+  {
+    // A map leaves the queue once its migration completes, so each pass
+    // either uses up the budget or finishes the map at the head.
+    HMap *hmap = containerOf(queue->next, HMap, queued);
+    if (hmap->engine == HMAP_SWISS)
+    {
+      done += SwissHelpRehashing(hmap, work - done);
+    }
+    else
+    {
+      done += HashMapHelpRehashing(hmap, work - done);
+    }
+  }
+  return done;
+}
+
+bool HashMapRehashPending()
+{
+  return !DListEmpty(rehashQueue());
+}
+
+static size_t homeMask(HMap *hmap, HTab *htab)
+{
+  return hmap->engine == HMAP_SWISS ? SwissHomeMask(htab) : htab->mask;
+}
+
+static void scanHome(HMap *hmap, HTab *htab, size_t pos, void (*f)(HNode *, void *), void *arg)
+{
+  if (hmap->engine == HMAP_SWISS)
+  {
+    return SwissScanHome(htab, pos, f, arg);
+  }
+  for (HNode *node = htab->bucket[pos]; node != NULL; node = node->next)
+  {
+    f(node, arg);
+  }
+}
+
+static uint64_t reverseBits(uint64_t v)
+{
+  v = __builtin_bswap64(v);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+  v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+  return ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+}
+
+// Adds one to the bits of cursor under mask, counting from the top bit of
+// the mask down.
+static uint64_t scanNext(uint64_t cursor, uint64_t mask)
+{
+  cursor |= ~mask;
+  return reverseBits(reverseBits(cursor) + 1);
+}
+
+uint64_t HashMapScan(HMap *hmap, uint64_t cursor, void (*f)(HNode *, void *), void *arg)
+{
+  HTab *small = &hmap->newer;
+  HTab *large = &hmap->older;
+  if (!small->bucket)
+  {
+    return 0;
+  }
+  if (!large->bucket)
+  {
+    size_t mask = homeMask(hmap, small);
+    scanHome(hmap, small, cursor & mask, f, arg);
+    return scanNext(cursor, mask);
+  }
+
+  // Mid-resize: the bucket in the smaller table, then every bucket of the
+  // larger one that it splits into.
+  if (homeMask(hmap, small) > homeMask(hmap, large))
+  {
+    std::swap(small, large);
+  }
+  uint64_t smallMask = homeMask(hmap, small);
+  uint64_t largeMask = homeMask(hmap, large);
+  scanHome(hmap, small, cursor & smallMask, f, arg);
+  do
+  {
+    scanHome(hmap, large, cursor & largeMask, f, arg);
+    cursor = scanNext(cursor, largeMask);
+  } while (cursor & (smallMask ^ largeMask));
+  return cursor;
+}
+
+bool HashMapParseEngine(const char *name, uint32_t *engine)
+{
+  for (uint32_t i = HMAP_CHAINED; i <= HMAP_SWISS; i++)
+  {
+    if (strcmp(name, HashMapEngineName(i)) == 0)
+    {
+      *engine = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *HashMapEngineName(uint32_t engine)
+{
+  switch (engine)
+  {
+  case HMAP_CHAINED:
+    return "chained";
+  case HMAP_SWISS:
+    return "swiss";
+  default:
+    return "unknown";
+  }
+}
@@ -0,0 +1,160 @@
+#include <assert.h>
+#include <algorithm>
+#include <utility>
+
+#include "outgoing.h"
+
+Outgoing::~Outgoing()
+{
+  OutgoingClear(this);
+}
+
+// Appends value's bytes by reference.
+void OutgoingSplice(Outgoing *out, Value *value)
+{
+  Splice splice;
+  splice.at = out->consumed + BufferSize(&out->data);
+  splice.value = ValueRef(value);
+  out->splices.push_back(splice);
+  out->splicedBytes += value->len;
+}
+
+// Bytes spliced in at or after inline offset pos.
+size_t OutgoingSplicedSince(const Outgoing *out, size_t pos)
+{
+  uint64_t at = out->consumed + pos;
+  size_t total = 0;
+  for (size_t i = out->splices.size(); i > out->head && out->splices[i - 1].at >= at; i--)
+  {
+    total += out->splices[i - 1].value->len;
+  }
+  return total;
+}
+
+// Keeps the first len inline bytes and the values spliced before them.
+void OutgoingTruncate(Outgoing *out, size_t len)
+{
+  uint64_t at = out->consumed + len;
+  while (out->splices.size() > out->head && out->splices.back().at >= at)
+  {
+    assert(out->splices.size() > out->head + 1 || out->sentOfFront == 0);
+    out->splicedBytes -= out->splices.back().value->len;
+    ValueRelease(out->splices.back().value);
+    out->splices.pop_back();
+  }
+  BufferTruncate(&out->data, len);
+}
+
+// Appends everything in src to dst, handing over its value references.
+void OutgoingMove(Outgoing *dst, Outgoing *src)
+{
+  assert(src->sentOfFront == 0);
+  uint64_t base = dst->consumed + BufferSize(&dst->data);
+  for (size_t i = src->head; i < src->splices.size(); i++)
+  {
+    Splice splice = src->splices[i];
+    splice.at = base + (splice.at - src->consumed);
+    dst->splices.push_back(splice);
+  }
+  dst->splicedBytes += src->splicedBytes;
+  src->splicedBytes = 0;
+  src->splices.clear();
+  src->head = 0;
+  BufferAppend(&dst->data, BufferData(&src->data), BufferSize(&src->data));
+  src->consumed += BufferSize(&src->data);
+  BufferConsume(&src->data, BufferSize(&src->data));
+}
+
+// Describes up to max pieces of the pending bytes, in order.
+size_t OutgoingIovecs(Outgoing *out, struct iovec *iov, size_t max)
+{
+  uint8_t *base = BufferData(&out->data);
+  size_t size = BufferSize(&out->data);
+  size_t n = 0;
+  size_t pos = 0;
+  for (size_t i = out->head; i < out->splices.size() && n < max; i++)
+  {
+    const Splice &splice = out->splices[i];
+    size_t rel = (size_t)(splice.at - out->consumed);
+    if (rel > pos)
+    {
+      iov[n++] = {base + pos, rel - pos};
+      pos = rel;
+      if (n == max)
+      {
+        return n;
+      }
+    }
+    size_t skip = i == out->head ? out->sentOfFront : 0;
+    if (splice.value->len > skip)
+    {
+      iov[n++] = {splice.value->data + skip, splice.value->len - skip};
+    }
+  }
+  if (n < max && pos < size)
+  {
+    iov[n++] = {base + pos, size - pos};
+  }
+  return n;
+}
+
+// Drops len sent bytes from the front, releasing values fully sent.
+void OutgoingConsume(Outgoing *out, size_t len)
+{
+  while (true)
+  {
+    bool spliced = out->head < out->splices.size();
+    size_t inlineBytes = spliced ? (size_t)(out->splices[out->head].at - out->consumed)
+                                 : BufferSize(&out->data);
+    size_t take = std::min(len, inlineBytes);
+    BufferConsume(&out->data, take);
+    out->consumed += take;
+    len -= take;
+    if (!spliced || out->splices[out->head].at != out->consumed)
+    {
+      break;
+    }
+
+    Value *value = out->splices[out->head].value;
+    take = std::min(len, value->len - out->sentOfFront);
+    out->sentOfFront += take;
+    len -= take;
+    if (out->sentOfFront < value->len)
+    {
+      break;
+    }
+    out->splicedBytes -= value->len;
+    ValueRelease(value);
+    out->sentOfFront = 0;
+    if (++out->head == out->splices.size())
+    {
+      out->splices.clear();
+      out->head = 0;
+    }
+  }
+  assert(len == 0);
+}
+
+void OutgoingSwap(Outgoing *a, Outgoing *b)
+{
+  BufferSwap(&a->data, &b->data);
+  a->splices.swap(b->splices);
+  std::swap(a->head, b->head);
+  std::swap(a->splicedBytes, b->splicedBytes);
+  std::swap(a->consumed, b->consumed);
+  std::swap(a->sentOfFront, b->sentOfFront);
+}
+
+void OutgoingClear(Outgoing *out)
+{
+  for (size_t i = out->head; i < out->splices.size(); i++)
+  {
+    ValueRelease(out->splices[i].value);
+  }
+  out->splices.clear();
+  out->head = 0;
+  out->splicedBytes = 0;
+  out->sentOfFront = 0;
+  out->consumed += BufferSize(&out->data);
+  BufferConsume(&out->data, BufferSize(&out->data));
+}
@@ -1,6 +1,7 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <cstdlib>
 #include <cstdio>
 #include <unistd.h>
@@ -10,48 +11,189 @@
 #include <math.h>
 #include <cstring>
 #include <fcntl.h>
-#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <sys/uio.h>
 
 // #include <map>
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <common.h>
+#include <globmatch.h>
 #include <hashtable.h>
 #include <zset.h>
-#include <heap.h>
+#include <timerwheel.h>
 #include <doublelinklist.h>
 #include <threadpool.h>
+#include <eventloop.h>
+#include <mailbox.h>
+#include <uring.h>
+#include <buffer.h>
+#include <outgoing.h>
+#include <command.h>
 
-typedef std::vector<uint8_t> Buffer;
+enum
+{
+  CONN_NORMAL = 0,
+  CONN_CLASS_COUNT
+};
+
+static const char *const kConnClassNames[CONN_CLASS_COUNT] = {"normal"};
+
+// Pending output past `soft` pauses reading and processing until it drains;
+// past `hard` the connection is closed.
+struct OutputLimit
+{
+  size_t soft = 0;
+  size_t hard = 0;
+};
 
 struct Conn
 {
   int fd = -1;
+  struct sockaddr_in addr = {};
+  uint32_t connClass = CONN_NORMAL;
 
   bool want_write = false;
   bool want_read = false;
   bool want_close = false;
+  uint32_t events = 0;
+  // A request is executing on another shard; the pipeline waits for its
+  // reply so responses stay in order.
+  bool forwarding = false;
 
   Buffer incoming;
-  Buffer outgoing;
+  Outgoing outgoing;
+  // Arguments of the request being run: views into incoming, reused across
+  // requests so parsing allocates nothing once the capacity has settled.
+  std::vector<std::string_view> args;
+
+  // io_uring: bytes owned by the in-flight send, and submitted operations
+  // that have not completed yet. The Conn outlives its fd until both drain.
+  Outgoing sending;
+  std::vector<struct iovec> sendIov;
+  struct msghdr sendMsg = {};
+  uint32_t inflight = 0;
+  bool recvArmed = false;
+  bool recvCancel = false;
 
   uint64_t lastActiveMS = 0;
-  DList idleNode;
+  TimerNode idleTimer;
+  // Linked in Shard::bufferList while a buffer is above kBufferBaseline.
+  DList bufferNode;
 };
 
-static struct
+// One event loop thread. Each shard owns its listener, connections, timers
+// and a hash partition of the keyspace; nothing in here is shared.
+struct Shard
 {
+  size_t id = 0;
+  pthread_t thread;
+  int listenFd = -1;
+  int wakeFd = -1;
+  std::atomic<bool> wakePending{false};
+  Mailbox mailbox;
+
+  EventLoop loop;
+  bool uring = false;
+  IoUring ring;
+  uint64_t wakeCount = 0;
+
   HMap database;
   std::vector<Conn *> fd2conn;
-  DList idleList;
-  std::vector<HeapItem> heap;
+  DList bufferList;
+  // Connection idle timeouts and key TTLs.
+  TimerWheel idleTimers;
+  TimerWheel keyTimers;
+  // Keys expired per processTimers() call; adapts to the backlog.
+  size_t expireBudget = 0;
+  // Moving average of the cost of one unit of hash table migration.
+  double rehashUnitNS = 0;
+  // Argument views for forwarded requests run on this shard.
+  std::vector<std::string_view> args;
+  // Indexed like kCommands.
+  std::vector<CommandStats> stats;
+};
+
+// A request travelling between shards. The owner runs it and sends the same
+// message back to the origin with the reply filled in.
+struct Forward
+{
+  MailboxNode node;
+  Shard *origin = NULL;
+  Conn *conn = NULL;
+  bool done = false;
+  const Command *command = NULL;
+  std::vector<uint8_t> request;
+  Outgoing reply;
+
+  // Commands that visit every shard hop through them in order and
+  // accumulate array elements in reply.
+  bool allShards = false;
+  size_t hops = 0;
+  uint32_t count = 0;
+};
+
+static struct
+{
+  std::vector<Shard *> shards;
   ThreadPool threadPool;
 } gData;
 
+static thread_local Shard *gShard = NULL;
+
+static struct
+{
+  int eventLoop = EVENT_LOOP_EPOLL;
+  bool ioUring = false;
+  size_t threads = 1;
+  // For the keyspace and every zset's member index.
+  uint32_t hashEngine = HMAP_CHAINED;
+  OutputLimit outputLimits[CONN_CLASS_COUNT] = {{16 << 20, 256 << 20}};
+} gConfig;
+
+const unsigned kUringEntries = 4096;
+const uint16_t kUringBufCount = 1024;
+const size_t kUringBufSize = 16 * 1024;
+const uint16_t kUringBufGroup = 0;
+
 const size_t kMaxMsg = (32 << 20);
+// A full request always fits, so reading stops here only while the
+// pipeline waits on a forwarded request.
+const size_t kMaxIncoming = 4 + kMaxMsg;
+const size_t kReadMin = 16 * 1024;
+const size_t kBufferBaseline = 16 * 1024;
+const uint64_t kBufferIdleMS = 1000;
+// String values at least this long are sent by reference instead of copied.
+const size_t kSpliceMin = 16 * 1024;
+const size_t kMaxIovecs = 64;
 const size_t kMaxArgs = (200 * 1000);
 const uint64_t kIdleTimeoutMS = 5 * 1000;
+const size_t kExpireMinWork = 2000;
+const size_t kExpireMaxWork = 256 * 1000;
+// SCAN cursors carry the shard in their low bits and the position in that
+// shard's table above them.
+const uint32_t kScanShardBits = 8;
+const uint64_t kScanShardMask = (1 << kScanShardBits) - 1;
+const size_t kMaxThreads = 1 << kScanShardBits;
+const size_t kScanDefaultCount = 10;
+// Buckets a scan call may visit per requested element before it returns
+// short, so that a sparse table does not turn one call into a full pass.
+const size_t kScanVisitsPerCount = 10;
+// Upper bound on one expiry pass however large the budget has grown.
+const uint64_t kExpireMaxMS = 5;
+// Idle loop iterations spend this long finishing hash table resizes.
+const uint64_t kRehashIdleNS = 1000 * 1000;
+const size_t kRehashBatch = 1024;
+// Migration a single command may absorb on the map it touches. The step
+// size follows from the measured cost of a unit of work.
+const uint64_t kRehashStepNS = 2 * 1000;
+const size_t kRehashMinStep = 16;
+const size_t kRehashMaxStep = 4096;
 
 enum
 {
@@ -88,7 +230,7 @@ enum
 struct LookupKey
 {
   struct HNode node;
-  std::string key;
+  std::string_view key;
 };
 
 struct Entry
@@ -96,10 +238,10 @@ struct Entry
   struct HNode node;
   std::string key;
 
-  size_t heapIndex = -1;
+  TimerNode ttl;
   uint32_t type = 0;
 
-  std::string string;
+  Value *value = NULL;
 
   ZSet zset;
 };
@@ -124,6 +266,13 @@ static uint64_t GetMonotonicMSec()
   return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
 }
 
+static uint64_t GetMonotonicNSec()
+{
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
 static void fdSetNonBlock(int fd)
 {
   errno = 0;
@@ -143,117 +292,142 @@ static void fdSetNonBlock(int fd)
   }
 }
 
+// Frees a closed connection once no shard or io_uring operation refers to it.
+static void connRelease(Conn *conn)
+{
+  if (conn->fd < 0 && !conn->forwarding && conn->inflight == 0)
+  {
+    delete conn;
+  }
+}
+
 static void connDestroy(Conn *conn)
 {
+  if (gShard->uring)
+  {
+    // Completes the multishot recv and any send still owned by the kernel.
+    shutdown(conn->fd, SHUT_RDWR);
+  }
+  else
+  {
+    EventLoopDelete(&gShard->loop, conn->fd);
+  }
   (void)close(conn->fd);
-  gData.fd2conn[conn->fd] = NULL;
-  DListDetach(&conn->idleNode);
-  delete conn;
+  gShard->fd2conn[conn->fd] = NULL;
+  TimerWheelCancel(&gShard->idleTimers, &conn->idleTimer);
+  DListDetach(&conn->bufferNode);
+  DListInit(&conn->bufferNode);
+  conn->fd = -1;
+  connRelease(conn);
+}
+
+// Arguments are not NUL-terminated, so numbers are parsed from a copy on
+// the stack. Anything too long for it is not a valid number anyway.
+static bool copyNumber(std::string_view s, char (&out)[64])
+{
+  if (s.empty() || s.size() >= sizeof(out))
+  {
+    return false;
+  }
+  memcpy(out, s.data(), s.size());
+  out[s.size()] = 0;
+  return true;
 }
 
-static bool stringToDouble(const std::string &s, double &out)
+static bool stringToDouble(std::string_view s, double &out)
 {
+  char text[64];
+  if (!copyNumber(s, text))
+  {
+    return false;
+  }
   char *endPoint = NULL;
-  out = strtod(s.c_str(), &endPoint);
-  return endPoint == s.c_str() + s.size() && !isnan(out);
+  out = strtod(text, &endPoint);
+  return endPoint == text + s.size() && !isnan(out);
 }
 
-static bool stringToInterger(const std::string &s, int64_t &out)
+static bool stringToInterger(std::string_view s, int64_t &out)
 {
+  char text[64];
+  if (!copyNumber(s, text))
+  {
+    return false;
+  }
   char *endPoint = NULL;
-  out = strtoll(s.c_str(), &endPoint, 10);
-  return endPoint == s.c_str() + s.size();
+  out = strtoll(text, &endPoint, 10);
+  return endPoint == text + s.size();
 }
 
-static void appendBuffer(Buffer &buf, const uint8_t *data, size_t len)
+static bool stringToUnsigned(std::string_view s, uint64_t &out)
 {
-  buf.insert(buf.end(), data, data + len);
+  char text[64];
+  if (!copyNumber(s, text) || text[0] < '0' || text[0] > '9')
+  {
+    return false;
+  }
+  char *endPoint = NULL;
+  errno = 0;
+  out = strtoull(text, &endPoint, 10);
+  return endPoint == text + s.size() && errno == 0;
 }
 
-static void appendBufferu8(Buffer &buf, const uint8_t data)
+static void appendBuffer(Outgoing &buf, const uint8_t *data, size_t len)
 {
-  buf.push_back(data);
+  BufferAppend(&buf.data, data, len);
 }
 
-static void appendBufferu32(Buffer &buf, const uint32_t data)
+static void appendBufferu8(Outgoing &buf, const uint8_t data)
 {
-  appendBuffer(buf, (const uint8_t *)&data, 4);
+  BufferAppend(&buf.data, &data, 1);
 }
 
-static void appendBufferDouble(Buffer &buf, const double data)
+static void appendBufferu32(Outgoing &buf, const uint32_t data)
 {
-  appendBuffer(buf, (const uint8_t *)&data, 8);
+  appendBuffer(buf, (const uint8_t *)&data, 4);
 }
 
-static void appendBufferi64(Buffer &buf, const int64_t data)
+static void appendBufferDouble(Outgoing &buf, const double data)
 {
   appendBuffer(buf, (const uint8_t *)&data, 8);
 }
 
-static void consumeBuffer(std::vector<uint8_t> &buf, size_t len)
+static void appendBufferi64(Outgoing &buf, const int64_t data)
 {
-  buf.erase(buf.begin(), buf.begin() + len);
+  appendBuffer(buf, (const uint8_t *)&data, 8);
 }
 
 static bool readu32(const uint8_t *&data, const uint8_t *end, uint32_t &out)
 {
   if (data + 4 > end)
   {
-    return -1;
+    return false;
   }
   memcpy(&out, data, 4);
   data += 4;
   return true;
 }
 
-static bool readString(const uint8_t *&data, const uint8_t *end, size_t size, std::string &out)
+static bool readString(const uint8_t *&data, const uint8_t *end, size_t size, std::string_view &out)
 {
-  if (data + size > end)
+  if (size > (size_t)(end - data))
   {
-    return -1;
+    return false;
   }
-  out.assign(data, data + size);
+  out = std::string_view((const char *)data, size);
   data += size;
   return true;
 }
 
-static void HeapDelete(std::vector<HeapItem> &heap, size_t pos)
-{
-  heap[pos] = heap.back();
-  heap.pop_back();
-
-  if (pos < heap.size())
-  {
-    HeapUpdate(heap.data(), pos, heap.size());
-  }
-}
-
-static void HeapUpsert(std::vector<HeapItem> &heap, size_t pos, HeapItem item)
-{
-  if (pos < heap.size())
-  {
-    heap[pos] = item;
-  }
-  else
-  {
-    pos = heap.size();
-    heap.push_back(item);
-  }
-  HeapUpdate(heap.data(), pos, heap.size());
-}
-
 static void entrySetTTL(Entry *entry, int64_t ttl_ms)
 {
-  if (ttl_ms < 0 && entry->heapIndex != (size_t)-1)
+  if (ttl_ms < 0)
   {
-    HeapDelete(gData.heap, entry->heapIndex);
-    entry->heapIndex = -1;
+    TimerWheelCancel(&gShard->keyTimers, &entry->ttl);
   }
   else
   {
     uint64_t expireAt = GetMonotonicMSec() + (uint64_t)ttl_ms;
-    HeapItem item = {expireAt, &entry->heapIndex};
-    HeapUpsert(gData.heap, entry->heapIndex, item);
+    TimerWheelAdd(&gShard->keyTimers, &entry->ttl, expireAt);
   }
 }
 
@@ -261,16 +435,21 @@ static Entry *entryNew(uint32_t type)
 {
   Entry *entry = new Entry();
   entry->type = type;
+  entry->zset.hmap.engine = gConfig.hashEngine;
   return entry;
 }
 
-static Entry *entryDeleteSync(Entry *entry)
+static void entryDeleteSync(Entry *entry)
 {
   if (entry->type == T_ZSET)
   {
     ZSetClear(&entry->zset);
   }
-  return entry;
+  if (entry->value)
+  {
+    ValueRelease(entry->value);
+  }
+  delete entry;
 }
 
 static void entryDeleteFunc(void *arg)
@@ -286,6 +465,7 @@ static void entryDelete(Entry *entry)
   const size_t kLargeContainerSize = 1000;
   if (setSize > kLargeContainerSize)
   {
+    HashMapDequeue(&entry->zset.hmap);
     ThreadPoolQueue(&gData.threadPool, &entryDeleteFunc, entry);
   }
   else
@@ -301,31 +481,69 @@ static bool entryEqual(HNode *node, HNode *key)
   return entry->key == keyData->key;
 }
 
-static void outputNil(Buffer &buf)
+static bool entryExpired(Entry *entry, uint64_t nowMS)
+{
+  return TimerArmed(&entry->ttl) && entry->ttl.expireAt <= nowMS;
+}
+
+// Unlinks entry from the keyspace and frees it.
+static void entryEvict(Entry *entry)
+{
+  HNode *node = HashMapDelete(&gShard->database, &entry->node, [](HNode *node, HNode *key)
+                              { return node == key; });
+  assert(node == &entry->node);
+  entryDelete(entry);
+}
+
+static void lookupKeyInit(LookupKey &key, std::string_view name)
+{
+  key.key = name;
+  key.node.hcode = stringHash((const uint8_t *)name.data(), name.size());
+}
+
+// Every command reaches keys through here: a key past its deadline is
+// evicted on access instead of lingering until the expiry timer gets to it.
+static Entry *entryFind(LookupKey &key)
+{
+  HNode *node = HashMapLookup(&gShard->database, &key.node, &entryEqual);
+  if (!node)
+  {
+    return NULL;
+  }
+  Entry *entry = containerOf(node, Entry, node);
+  if (TimerArmed(&entry->ttl) && entryExpired(entry, GetMonotonicMSec()))
+  {
+    entryEvict(entry);
+    return NULL;
+  }
+  return entry;
+}
+
+static void outputNil(Outgoing &buf)
 {
   appendBufferu8(buf, TAG_NIL);
 }
 
-static void outputString(Buffer &buf, const char *s, size_t size)
+static void outputString(Outgoing &buf, const char *s, size_t size)
 {
   appendBufferu8(buf, TAG_STRING);
   appendBufferu32(buf, (uint32_t)size);
   appendBuffer(buf, (const uint8_t *)s, size);
 }
 
-static void outputInteger(Buffer &buf, const int64_t val)
+static void outputInteger(Outgoing &buf, const int64_t val)
 {
   appendBufferu8(buf, TAG_INTEGER);
   appendBufferi64(buf, val);
 }
 
-static void outputDouble(Buffer &buf, const double val)
+static void outputDouble(Outgoing &buf, const double val)
 {
   appendBufferu8(buf, TAG_DOUBLE);
   appendBufferDouble(buf, val);
 }
 
-static void outputError(Buffer &buf, uint32_t code, const std::string &msg)
+static void outputError(Outgoing &buf, uint32_t code, const std::string &msg)
 {
   appendBufferu8(buf, TAG_ERROR);
   appendBufferu32(buf, code);
@@ -333,106 +551,322 @@ static void outputError(Buffer &buf, uint32_t code, const std::string &msg)
   appendBuffer(buf, (const uint8_t *)msg.data(), msg.size());
 }
 
-static void outputArray(Buffer &buf, const uint32_t n)
+static void outputArray(Outgoing &buf, const uint32_t n)
 {
   appendBufferu8(buf, TAG_ARRAY);
   appendBufferu32(buf, n);
 }
 
-static size_t outputBeginArray(Buffer &buf)
+static size_t outputBeginArray(Outgoing &buf)
 {
-  buf.push_back(TAG_ARRAY);
+  appendBufferu8(buf, TAG_ARRAY);
   appendBufferu32(buf, 0);
-  return buf.size() - 4;
+  return BufferSize(&buf.data) - 4;
 }
 
-static void outputEndArray(Buffer &buf, size_t ctx, uint32_t n)
+static void outputEndArray(Outgoing &buf, size_t ctx, uint32_t n)
 {
-  assert(buf[ctx - 1] == TAG_ARRAY);
-  memcpy(&buf[ctx], &n, 4);
+  assert(BufferData(&buf.data)[ctx - 1] == TAG_ARRAY);
+  memcpy(BufferData(&buf.data) + ctx, &n, 4);
 }
 
-static void doGet(std::vector<std::string> &cmd, Buffer &buf)
+// Large values are referenced, not copied; see Value.
+static void outputValue(Outgoing &buf, Value *value)
 {
-  LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = stringHash((const uint8_t *)key.key.data(), key.key.size());
-
-  HNode *node = HashMapLookup(&gData.database, &key.node, &entryEqual);
+  if (value->len < kSpliceMin)
+  {
+    return outputString(buf, value->data, value->len);
+  }
+  appendBufferu8(buf, TAG_STRING);
+  appendBufferu32(buf, (uint32_t)value->len);
+  OutgoingSplice(&buf, value);
+}
 
-  if (!node)
+static void doGet(std::vector<std::string_view> &cmd, Outgoing &buf)
+{
+  LookupKey key;
+  lookupKeyInit(key, cmd[1]);
+  Entry *entry = entryFind(key);
+  if (!entry)
   {
     return outputNil(buf);
   }
 
-  Entry *entry = containerOf(node, Entry, node);
   if (entry->type != T_STRING)
   {
     return outputError(buf, ERROR_BAD_TYPE, "Not a string value");
   }
-  return outputString(buf, entry->string.data(), entry->string.size());
+  return outputValue(buf, entry->value);
 }
 
-static void doSet(std::vector<std::string> &cmd, Buffer &buf)
+static void doSet(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = stringHash((const uint8_t *)key.key.data(), key.key.size());
-
-  HNode *node = HashMapLookup(&gData.database, &key.node, &entryEqual);
-  if (node)
+  lookupKeyInit(key, cmd[1]);
+  Entry *ent = entryFind(key);
+  if (ent)
   {
-    Entry *ent = containerOf(node, Entry, node);
     if (ent->type != T_STRING)
     {
 
       return outputError(buf, ERROR_BAD_TYPE, "a non-string value exist");
     }
 
-    ent->string.swap(cmd[2]);
+    // In-flight replies keep the old bytes alive; see ValueAssign().
+    ent->value = ValueAssign(ent->value, cmd[2].data(), cmd[2].size());
   }
   else
   {
-    Entry *ent = entryNew(T_STRING);
-    ent->key.swap(key.key);
+    ent = entryNew(T_STRING);
+    ent->key.assign(key.key);
     ent->node.hcode = key.node.hcode;
-    ent->string.swap(cmd[2]);
-    HashMapInsert(&gData.database, &ent->node);
+    ent->value = ValueNew(cmd[2].data(), cmd[2].size());
+    HashMapInsert(&gShard->database, &ent->node);
   }
 
   return outputNil(buf);
 }
 
-static void doDel(std::vector<std::string> &cmd, Buffer &buf)
+static void doDel(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = stringHash((const uint8_t *)key.key.data(), key.key.size());
-
-  HNode *node = HashMapDelete(&gData.database, &key.node, &entryEqual);
-  if (node)
+  lookupKeyInit(key, cmd[1]);
+  Entry *entry = entryFind(key);
+  if (entry)
   {
-    entryDelete(containerOf(node, Entry, node));
+    entryEvict(entry);
   }
 
-  return outputInteger(buf, node ? 1 : 0);
+  return outputInteger(buf, entry ? 1 : 0);
 }
 
+struct KeyScan
+{
+  Outgoing *out = NULL;
+  uint64_t nowMS = 0;
+  uint32_t count = 0;
+};
+
 static bool cbKey(HNode *node, void *arg)
 {
-  Buffer &out = *(Buffer *)arg;
-  const std::string &key = containerOf(node, Entry, node)->key;
-  outputString(out, key.data(), key.size());
+  KeyScan &scan = *(KeyScan *)arg;
+  Entry *entry = containerOf(node, Entry, node);
+  if (entryExpired(entry, scan.nowMS))
+  {
+    return true;
+  }
+  outputString(*scan.out, entry->key.data(), entry->key.size());
+  scan.count++;
+  return true;
+}
+
+// The local shard's share of `keys`: elements only, no array header.
+static uint32_t doKeyPart(std::vector<std::string_view> &, Outgoing &buf)
+{
+  KeyScan scan;
+  scan.out = &buf;
+  scan.nowMS = GetMonotonicMSec();
+  HashMapForEach(&gShard->database, &cbKey, (void *)&scan);
+  return scan.count;
+}
+
+struct ScanOptions
+{
+  std::string_view match;
+  bool hasMatch = false;
+  size_t count = kScanDefaultCount;
+  // T_INIT for any type.
+  uint32_t type = T_INIT;
+};
+
+static bool argIs(std::string_view arg, const char *name)
+{
+  return arg.size() == strlen(name) && strncasecmp(arg.data(), name, arg.size()) == 0;
+}
+
+// [MATCH pattern] [COUNT n] [TYPE string|zset] from cmd[first] on; TYPE
+// only when allowType.
+static bool parseScanOptions(std::vector<std::string_view> &cmd, size_t first, bool allowType,
+                             ScanOptions &opts, Outgoing &buf)
+{
+  for (size_t i = first; i < cmd.size(); i += 2)
+  {
+    if (i + 1 >= cmd.size())
+    {
+      outputError(buf, ERROR_BAD_ARGUMENT, "syntax error");
+      return false;
+    }
+    std::string_view value = cmd[i + 1];
+    if (argIs(cmd[i], "match"))
+    {
+      opts.match = value;
+      opts.hasMatch = true;
+    }
+    else if (argIs(cmd[i], "count"))
+    {
+      int64_t count = 0;
+      if (!stringToInterger(value, count) || count <= 0)
+      {
+        outputError(buf, ERROR_BAD_ARGUMENT, "expect positive integer");
+        return false;
+      }
+      opts.count = (size_t)std::min(count, (int64_t)kMaxArgs);
+    }
+    else if (allowType && argIs(cmd[i], "type"))
+    {
+      if (argIs(value, "string"))
+      {
+        opts.type = T_STRING;
+      }
+      else if (argIs(value, "zset"))
+      {
+        opts.type = T_ZSET;
+      }
+      else
+      {
+        outputError(buf, ERROR_BAD_ARGUMENT, "unknown type");
+        return false;
+      }
+    }
+    else
+    {
+      outputError(buf, ERROR_BAD_ARGUMENT, "syntax error");
+      return false;
+    }
+  }
   return true;
 }
 
-static void doKey(std::vector<std::string> &, Buffer &buf)
+struct ScanBatch
+{
+  const ScanOptions *opts = NULL;
+  uint64_t nowMS = 0;
+  std::vector<HNode *> found;
+};
+
+static void cbScanKey(HNode *node, void *arg)
+{
+  ScanBatch &batch = *(ScanBatch *)arg;
+  Entry *entry = containerOf(node, Entry, node);
+  const ScanOptions &opts = *batch.opts;
+  if (entryExpired(entry, batch.nowMS) || (opts.type != T_INIT && entry->type != opts.type) ||
+      (opts.hasMatch && !GlobMatch(opts.match, entry->key)))
+  {
+    return;
+  }
+  batch.found.push_back(node);
+}
+
+static void cbScanMember(HNode *node, void *arg)
+{
+  ScanBatch &batch = *(ScanBatch *)arg;
+  ZNode *znode = containerOf(node, ZNode, hmap);
+  if (batch.opts->hasMatch && !GlobMatch(batch.opts->match, std::string_view(znode->name, znode->len)))
+  {
+    return;
+  }
+  batch.found.push_back(node);
+}
+
+// Advances the cursor until COUNT matches are in, the scan completes, or
+// the visit budget runs out.
+static uint64_t scanCollect(HMap *hmap, uint64_t cursor, void (*f)(HNode *, void *), ScanBatch &batch)
+{
+  size_t visits = batch.opts->count * kScanVisitsPerCount;
+  do
+  {
+    cursor = HashMapScan(hmap, cursor, f, &batch);
+  } while (cursor != 0 && batch.found.size() < batch.opts->count && --visits > 0);
+  return cursor;
+}
+
+static void outputCursor(Outgoing &buf, uint64_t cursor)
+{
+  char text[32];
+  int len = snprintf(text, sizeof(text), "%llu", (unsigned long long)cursor);
+  outputString(buf, text, (size_t)len);
+}
+
+// SCAN cursor [MATCH pattern] [COUNT n] [TYPE string|zset]. Walks the
+// shards in turn, one shard per call; the reply is [next cursor, keys].
+static void doScan(std::vector<std::string_view> &cmd, Outgoing &buf)
+{
+  uint64_t cursor = 0;
+  if (!stringToUnsigned(cmd[1], cursor) || (cursor & kScanShardMask) != gShard->id)
+  {
+    return outputError(buf, ERROR_BAD_ARGUMENT, "invalid cursor");
+  }
+  ScanOptions opts;
+  if (!parseScanOptions(cmd, 2, true, opts, buf))
+  {
+    return;
+  }
+
+  ScanBatch batch;
+  batch.opts = &opts;
+  batch.nowMS = GetMonotonicMSec();
+  uint64_t next = scanCollect(&gShard->database, cursor >> kScanShardBits, &cbScanKey, batch);
+  if (next != 0)
+  {
+    next = (next << kScanShardBits) | gShard->id;
+  }
+  else if (gShard->id + 1 < gData.shards.size())
+  {
+    next = gShard->id + 1;
+  }
+
+  outputArray(buf, 2);
+  outputCursor(buf, next);
+  outputArray(buf, (uint32_t)batch.found.size());
+  for (HNode *node : batch.found)
+  {
+    Entry *entry = containerOf(node, Entry, node);
+    outputString(buf, entry->key.data(), entry->key.size());
+  }
+}
+
+static size_t connOutputSize(Conn *conn)
 {
-  outputArray(buf, (uint32_t)HashMapSize(&gData.database));
-  HashMapForEach(&gData.database, &cbKey, (void *)&buf);
+  return OutgoingSize(&conn->outgoing) + OutgoingSize(&conn->sending);
 }
 
-static void doExpire(std::vector<std::string> &cmd, Buffer &buf)
+static const OutputLimit &connOutputLimit(Conn *conn)
+{
+  return gConfig.outputLimits[conn->connClass];
+}
+
+// One line per connection of the local shard, for finding clients that
+// hold on to large buffers.
+static uint32_t doStatsPart(std::vector<std::string_view> &, Outgoing &buf)
+{
+  uint32_t n = 0;
+  uint64_t nowMS = GetMonotonicMSec();
+  for (Conn *conn : gShard->fd2conn)
+  {
+    if (!conn)
+    {
+      continue;
+    }
+    uint32_t ip = conn->addr.sin_addr.s_addr;
+    size_t output = connOutputSize(conn);
+    char line[512];
+    int len = snprintf(line, sizeof(line),
+                       "shard=%zu fd=%d addr=%u.%u.%u.%u:%u class=%s idle=%llu "
+                       "in=%zu in-cap=%zu out=%zu out-cap=%zu paused=%d",
+                       gShard->id, conn->fd,
+                       ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, (ip >> 24) & 255,
+                       ntohs(conn->addr.sin_port), kConnClassNames[conn->connClass],
+                       (unsigned long long)(nowMS - conn->lastActiveMS),
+                       BufferSize(&conn->incoming), BufferCapacity(&conn->incoming),
+                       output, BufferCapacity(&conn->outgoing.data) + BufferCapacity(&conn->sending.data),
+                       output >= connOutputLimit(conn).soft ? 1 : 0);
+    outputString(buf, line, std::min((size_t)len, sizeof(line) - 1));
+    n++;
+  }
+  return n;
+}
+
+static void doExpire(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   int64_t ttl_ms = 0;
   if (!stringToInterger(cmd[2], ttl_ms))
@@ -441,54 +875,47 @@ static void doExpire(std::vector<std::string> &cmd, Buffer &buf)
   }
 
   LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = stringHash((uint8_t *)key.key.data(), key.key.size());
-  HNode *node = HashMapLookup(&gData.database, &key.node, &entryEqual);
-  if (node)
+  lookupKeyInit(key, cmd[1]);
+  Entry *entry = entryFind(key);
+  if (entry)
   {
-    Entry *entry = containerOf(node, Entry, node);
     entrySetTTL(entry, ttl_ms);
   }
-  return outputInteger(buf, node ? 1 : 0);
+  return outputInteger(buf, entry ? 1 : 0);
 }
 
-static void doTTL(std::vector<std::string> &cmd, Buffer &buf)
+static void doTTL(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = stringHash((uint8_t *)key.key.data(), key.key.size());
-
-  HNode *node = HashMapLookup(&gData.database, &key.node, &entryEqual);
-  if (!node)
+  lookupKeyInit(key, cmd[1]);
+  Entry *entry = entryFind(key);
+  if (!entry)
   {
     return outputInteger(buf, -2);
   }
 
-  Entry *entry = containerOf(node, Entry, node);
-  if (entry->heapIndex == (size_t)-1)
+  if (!TimerArmed(&entry->ttl))
   {
     return outputInteger(buf, -1);
   }
-  uint64_t expireAt = gData.heap[entry->heapIndex].val;
+  uint64_t expireAt = entry->ttl.expireAt;
   uint64_t nowMS = GetMonotonicMSec();
   return outputInteger(buf, expireAt > nowMS ? (expireAt - nowMS) : 0);
 }
 
-static ZSet *ExpectZSet(std::string &s)
+static ZSet *ExpectZSet(std::string_view s)
 {
   LookupKey key;
-  key.key.swap(s);
-  key.node.hcode = stringHash((uint8_t *)key.key.data(), key.key.size());
-  HNode *node = HashMapLookup(&gData.database, &key.node, &entryEqual);
-  if (!node)
+  lookupKeyInit(key, s);
+  Entry *entry = entryFind(key);
+  if (!entry)
   {
     return (ZSet *)&kEmptyZSet;
   }
-  Entry *entry = containerOf(node, Entry, node);
   return entry->type == T_ZSET ? &entry->zset : NULL;
 }
 
-static void doZAdd(std::vector<std::string> &cmd, Buffer &buf)
+static void doZAdd(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   double score = 0;
   if (!stringToDouble(cmd[2], score))
@@ -497,29 +924,26 @@ static void doZAdd(std::vector<std::string> &cmd, Buffer &buf)
   }
 
   LookupKey key;
-  key.key.swap(cmd[1]);
-  key.node.hcode = stringHash((uint8_t *)key.key.data(), key.key.size());
-  HNode *node = HashMapLookup(&gData.database, &key.node, &entryEqual);
-
-  Entry *entry = NULL;
-  if (!node)
+  lookupKeyInit(key, cmd[1]);
+  Entry *entry = entryFind(key);
+  if (!entry)
   {
     entry = entryNew(T_ZSET);
-    entry->key.swap(key.key);
+    entry->key.assign(key.key);
     entry->node.hcode = key.node.hcode;
-    HashMapInsert(&gData.database, &entry->node);
+    HashMapInsert(&gShard->database, &entry->node);
   }
-  else
+  else if (entry->type != T_ZSET)
   {
-    entry = containerOf(node, Entry, node);
+    return outputError(buf, ERROR_BAD_TYPE, "expecting zset");
   }
 
-  const std::string &name = cmd[3];
+  std::string_view name = cmd[3];
   bool added = ZSetInsert(&entry->zset, name.data(), name.size(), score);
   return outputInteger(buf, (int64_t)added);
 }
 
-static void doZRemove(std::vector<std::string> &cmd, Buffer &buf)
+static void doZRemove(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   ZSet *zset = ExpectZSet(cmd[1]);
   if (!zset)
@@ -527,7 +951,7 @@ static void doZRemove(std::vector<std::string> &cmd, Buffer &buf)
     return outputError(buf, ERROR_BAD_TYPE, "expecting zset");
   }
 
-  const std::string &name = cmd[2];
+  std::string_view name = cmd[2];
   ZNode *znode = ZSetLookup(zset, name.data(), name.size());
   if (znode)
   {
@@ -536,7 +960,7 @@ static void doZRemove(std::vector<std::string> &cmd, Buffer &buf)
   return outputInteger(buf, znode ? 1 : 0);
 }
 
-static void doZScore(std::vector<std::string> &cmd, Buffer &buf)
+static void doZScore(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
   ZSet *zset = ExpectZSet(cmd[1]);
   if (!zset)
@@ -544,25 +968,58 @@ static void doZScore(std::vector<std::string> &cmd, Buffer &buf)
     return outputError(buf, ERROR_BAD_TYPE, "expecting zset");
   }
 
-  const std::string &name = cmd[2];
+  std::string_view name = cmd[2];
   ZNode *znode = ZSetLookup(zset, name.data(), name.size());
   return znode ? outputDouble(buf, znode->score) : outputNil(buf);
 }
 
-static void doZQuery(std::vector<std::string> &cmd, Buffer &buf)
+// ZSCAN key cursor [MATCH pattern] [COUNT n]: [next cursor, member,
+// score pairs].
+static void doZScan(std::vector<std::string_view> &cmd, Outgoing &buf)
+{
+  uint64_t cursor = 0;
+  if (!stringToUnsigned(cmd[2], cursor))
+  {
+    return outputError(buf, ERROR_BAD_ARGUMENT, "invalid cursor");
+  }
+  ScanOptions opts;
+  if (!parseScanOptions(cmd, 3, false, opts, buf))
+  {
+    return;
+  }
+  ZSet *zset = ExpectZSet(cmd[1]);
+  if (!zset)
+  {
+    return outputError(buf, ERROR_BAD_TYPE, "expecting zset");
+  }
+
+  ScanBatch batch;
+  batch.opts = &opts;
+  uint64_t next = scanCollect(&zset->hmap, cursor, &cbScanMember, batch);
+
+  outputArray(buf, 2);
+  outputCursor(buf, next);
+  outputArray(buf, (uint32_t)batch.found.size() * 2);
+  for (HNode *node : batch.found)
+  {
+    ZNode *znode = containerOf(node, ZNode, hmap);
+    outputString(buf, znode->name, znode->len);
+    outputDouble(buf, znode->score);
+  }
+}
+
+static void doZQuery(std::vector<std::string_view> &cmd, Outgoing &buf)
 {
-  printf("ZQuery");
   double score = 0;
-  if (stringToDouble(cmd[2], score))
+  if (!stringToDouble(cmd[2], score))
   {
     return outputError(buf, ERROR_BAD_ARGUMENT, "expect floating point number");
   }
 
-  const std::string &name = cmd[3];
+  std::string_view name = cmd[3];
   int64_t offset = 0;
   int64_t limit = 0;
-  printf("Command: %s %s", cmd[4].data(), cmd[5].data());
-  if (stringToInterger(cmd[4], offset) || stringToInterger(cmd[5], limit))
+  if (!stringToInterger(cmd[4], offset) || !stringToInterger(cmd[5], limit))
   {
     return outputError(buf, ERROR_BAD_ARGUMENT, "expect integer number");
   }
@@ -594,77 +1051,85 @@ static void doZQuery(std::vector<std::string> &cmd, Buffer &buf)
   outputEndArray(buf, ctx, (uint32_t)n);
 }
 
-static void doRequest(std::vector<std::string> &cmd, Buffer &buf)
+static constexpr Command kCommands[] = {
+    {"get", 2, &doGet, CMD_READONLY, 1},
+    {"set", 3, &doSet, CMD_WRITE, 1},
+    {"del", 2, &doDel, CMD_WRITE, 1},
+    {"keys", 1, NULL, CMD_READONLY | CMD_SLOW | CMD_ALL_SHARDS, 0, &doKeyPart},
+    {"pexpire", 3, &doExpire, CMD_WRITE, 1},
+    {"pttl", 2, &doTTL, CMD_READONLY, 1},
+    {"zadd", 4, &doZAdd, CMD_WRITE, 1},
+    {"zrem", 3, &doZRemove, CMD_WRITE, 1},
+    {"zscore", 3, &doZScore, CMD_READONLY, 1},
+    {"zquery", 6, &doZQuery, CMD_READONLY, 1},
+    {"stats", 1, NULL, CMD_READONLY | CMD_SLOW | CMD_ALL_SHARDS, 0, &doStatsPart},
+    {"scan", -2, &doScan, CMD_READONLY | CMD_CURSOR, 0},
+    {"zscan", -3, &doZScan, CMD_READONLY, 1},
+};
+
+const size_t kCommandCount = sizeof(kCommands) / sizeof(kCommands[0]);
+static constexpr auto kCommandIndex = CommandIndexBuild<32>(kCommands);
+static_assert(kCommandIndex.seed != 0, "no perfect hash for the command table");
+
+static const Command *commandFind(std::vector<std::string_view> &cmd)
 {
-  if (cmd.size() == 2 && cmd[0] == "get")
-  {
-    return doGet(cmd, buf);
-  }
-  else if (cmd.size() == 3 && cmd[0] == "set")
-  {
-    return doSet(cmd, buf);
-  }
-  else if (cmd.size() == 2 && cmd[0] == "del")
-  {
-    return doDel(cmd, buf);
-  }
-  else if (cmd.size() == 1 && cmd[0] == "keys")
-  {
-    return doKey(cmd, buf);
-  }
-  else if (cmd.size() == 3 && cmd[0] == "pexpire")
-  {
-    return doExpire(cmd, buf);
-  }
-  else if (cmd.size() == 2 && cmd[0] == "pttl")
-  {
-    return doTTL(cmd, buf);
-  }
-  if (cmd.size() == 4 && cmd[0] == "zadd")
+  return cmd.empty() ? NULL : CommandLookup(kCommands, kCommandIndex, cmd[0]);
+}
+
+static void doRequest(const Command *command, std::vector<std::string_view> &cmd, Outgoing &buf)
+{
+  if (!command)
   {
-    return doZAdd(cmd, buf);
+    return outputError(buf, ERROR_UNKNOWN, "Unknown Command");
   }
-  else if (cmd.size() == 3 && cmd[0] == "zrem")
+
+  CommandStats &stats = gShard->stats[command - kCommands];
+  if (!CommandArityOk(command, cmd.size()))
   {
-    return doZRemove(cmd, buf);
+    stats.rejected++;
+    return outputError(buf, ERROR_BAD_ARGUMENT, "wrong number of arguments");
   }
-  else if (cmd.size() == 3 && cmd[0] == "zscore")
+
+  size_t start = BufferSize(&buf.data);
+  if (command->part)
   {
-    return doZScore(cmd, buf);
+    size_t ctx = outputBeginArray(buf);
+    outputEndArray(buf, ctx, command->part(cmd, buf));
   }
-  else if (cmd.size() == 6 && cmd[0] == "zquery")
+  else
   {
-    return doZQuery(cmd, buf);
+    command->handler(cmd, buf);
   }
-  else
+  stats.calls++;
+  if (BufferData(&buf.data)[start] == TAG_ERROR)
   {
-    outputError(buf, ERROR_UNKNOWN, "Unknown Command");
+    stats.errors++;
   }
 }
 
-static void responseBegin(Buffer &buf, size_t *header)
+static void responseBegin(Outgoing &buf, size_t *header)
 {
-  *header = buf.size();
+  *header = BufferSize(&buf.data);
   appendBufferu32(buf, 0);
 }
 
-static size_t responseSize(Buffer &buf, size_t header)
+static size_t responseSize(Outgoing &buf, size_t header)
 {
-  return buf.size() - header - 4;
+  return BufferSize(&buf.data) - header - 4 + OutgoingSplicedSince(&buf, header + 4);
 }
 
-static void responseEnd(Buffer &buf, size_t header)
+static void responseEnd(Outgoing &buf, size_t header)
 {
   size_t msgSize = responseSize(buf, header);
   if (msgSize > kMaxMsg)
   {
-    buf.resize(header + 4);
+    OutgoingTruncate(&buf, header + 4);
     outputError(buf, ERROR_TOO_BIG, "Message too big");
     msgSize = responseSize(buf, header);
   }
 
   uint32_t len = (uint32_t)msgSize;
-  memcpy(&buf[header], &len, 4);
+  memcpy(BufferData(&buf.data) + header, &len, 4);
 }
 
 // static void makeResponse(const Buffer &resp, std::vector<uint8_t> &ongoing)
@@ -675,11 +1140,12 @@ static void responseEnd(Buffer &buf, size_t header)
 //   appendBuffer(ongoing, resp.data.data(), resp.data.size());
 // }
 
-static int32_t parseReq(const uint8_t *req, size_t size, std::vector<std::string> &out)
+static int32_t parseReq(const uint8_t *req, size_t size, std::vector<std::string_view> &out)
 {
   const uint8_t *end = req + size;
   uint32_t nstr = 0;
-  if (!readu32(req, end, nstr) < 0 || nstr > kMaxArgs)
+  out.clear();
+  if (!readu32(req, end, nstr) || nstr > kMaxArgs)
   {
     return -1;
   }
@@ -687,11 +1153,11 @@ static int32_t parseReq(const uint8_t *req, size_t size, std::vector<std::string
   while (out.size() < nstr)
   {
     uint32_t len = 0;
-    if (!readu32(req, end, len) < 0)
+    if (!readu32(req, end, len))
     {
       return -1;
     }
-    out.push_back(std::string());
+    out.emplace_back();
     if (!readString(req, end, len, out.back()))
     {
       return -1;
@@ -705,15 +1171,114 @@ static int32_t parseReq(const uint8_t *req, size_t size, std::vector<std::string
   return 0;
 }
 
-static bool try_one_request(Conn *conn)
+static Shard *shardOf(std::string_view key)
 {
-  if (conn->incoming.size() < 4)
-  {
+  uint64_t hcode = stringHash((const uint8_t *)key.data(), key.size());
+  // The top bits: hash tables index buckets with the low ones.
+  return gData.shards[((hcode >> 32) * gData.shards.size()) >> 32];
+}
+
+// The shard that must run cmd, or NULL when it visits every shard. Bad
+// requests stay local, where doRequest() reports the error.
+static Shard *cmdShard(const Command *command, std::vector<std::string_view> &cmd)
+{
+  if (gData.shards.size() == 1 || !command || !CommandArityOk(command, cmd.size()))
+  {
+    return gShard;
+  }
+  if (command->flags & CMD_ALL_SHARDS)
+  {
+    return NULL;
+  }
+  uint64_t cursor = 0;
+  if ((command->flags & CMD_CURSOR) && stringToUnsigned(cmd[1], cursor) &&
+      (cursor & kScanShardMask) < gData.shards.size())
+  {
+    return gData.shards[cursor & kScanShardMask];
+  }
+  if (command->firstKey == 0)
+  {
+    return gShard;
+  }
+  return shardOf(cmd[command->firstKey]);
+}
+
+static Shard *shardNext(Shard *shard)
+{
+  return gData.shards[(shard->id + 1) % gData.shards.size()];
+}
+
+static void shardSend(Shard *shard, Forward *forward)
+{
+  MailboxPush(&shard->mailbox, &forward->node);
+  if (!shard->wakePending.exchange(true))
+  {
+    uint64_t one = 1;
+    ssize_t rv = write(shard->wakeFd, &one, sizeof(one));
+    (void)rv;
+  }
+}
+
+static void forwardRequest(Conn *conn, Shard *owner, const Command *command,
+                           std::vector<std::string_view> &cmd, const uint8_t *request, size_t len)
+{
+  Forward *forward = new Forward();
+  forward->origin = gShard;
+  forward->conn = conn;
+  forward->command = command;
+  forward->request.assign(request, request + len);
+  if (!owner)
+  {
+    gShard->stats[command - kCommands].calls++;
+    forward->allShards = true;
+    forward->count = command->part(cmd, forward->reply);
+    forward->hops = gData.shards.size() - 1;
+    owner = shardNext(gShard);
+  }
+
+  conn->forwarding = true;
+  shardSend(owner, forward);
+}
+
+// Closes a connection whose replies went past the hard limit.
+static void connCheckOutput(Conn *conn)
+{
+  if (connOutputSize(conn) > connOutputLimit(conn).hard)
+  {
+    fprintf(stderr, "closing fd %d: output buffer over the hard limit (%zu bytes)\n",
+            conn->fd, connOutputSize(conn));
+    conn->want_close = true;
+  }
+}
+
+// Output past the soft limit, or a full incoming buffer: stop taking input.
+static bool connReadPaused(Conn *conn)
+{
+  return connOutputSize(conn) >= connOutputLimit(conn).soft ||
+         BufferSize(&conn->incoming) >= kMaxIncoming;
+}
+
+static bool try_one_request(Conn *conn)
+{
+  if (conn->forwarding || conn->want_close)
+  {
+    return false;
+  }
+  if (connOutputSize(conn) >= connOutputLimit(conn).soft)
+  {
+    // The rest of the pipeline waits in incoming until replies drain.
+    return false;
+  }
+
+  // Requests are parsed in place; consuming one only advances the cursor.
+  size_t size = BufferSize(&conn->incoming);
+  if (size < 4)
+  {
     return false;
   }
 
   uint32_t len = 0;
-  memcpy(&len, conn->incoming.data(), 4);
+  memcpy(&len, BufferData(&conn->incoming), 4);
   if (len > kMaxMsg)
   {
     msg("msg too long");
@@ -721,14 +1286,16 @@ static bool try_one_request(Conn *conn)
     return false;
   }
 
-  if (4 + len > conn->incoming.size())
+  if (4 + len > size)
   {
+    // Grow once for the whole request rather than doubling per read.
+    BufferReserve(&conn->incoming, 4 + len - size);
     return false;
   }
 
-  const uint8_t *request = &conn->incoming[4];
+  const uint8_t *request = BufferData(&conn->incoming) + 4;
 
-  std::vector<std::string> cmd;
+  std::vector<std::string_view> &cmd = conn->args;
   if (parseReq(request, len, cmd) < 0)
   {
     msg("Bad Request");
@@ -736,130 +1303,576 @@ static bool try_one_request(Conn *conn)
     return false;
   }
 
+  const Command *command = commandFind(cmd);
+  Shard *owner = cmdShard(command, cmd);
+  if (owner != gShard)
+  {
+    forwardRequest(conn, owner, command, cmd, request, len);
+    BufferConsume(&conn->incoming, 4 + len);
+    return false;
+  }
+
   size_t header_pos = 0;
   responseBegin(conn->outgoing, &header_pos);
-  doRequest(cmd, conn->outgoing);
+  doRequest(command, cmd, conn->outgoing);
   responseEnd(conn->outgoing, header_pos);
 
-  consumeBuffer(conn->incoming, 4 + len);
+  BufferConsume(&conn->incoming, 4 + len);
+  connCheckOutput(conn);
   return true;
 }
 
-static int32_t handleAccept(int fd)
+static void connTouch(Conn *conn)
 {
-  struct sockaddr_in client_addr = {};
-  socklen_t client_len = sizeof(client_addr);
-  int conn_fd = accept(fd, (sockaddr *)&client_addr, &client_len);
-  if (conn_fd < 0)
+  conn->lastActiveMS = GetMonotonicMSec();
+  TimerWheelAdd(&gShard->idleTimers, &conn->idleTimer, conn->lastActiveMS + kIdleTimeoutMS);
+}
+
+// Connections that grew a buffer past the baseline queue up, in activity
+// order, for connShrinkBuffers() once they have been quiet for a while.
+static void connTrackBuffers(Conn *conn)
+{
+  DListDetach(&conn->bufferNode);
+  DListInit(&conn->bufferNode);
+  if (BufferCapacity(&conn->incoming) > kBufferBaseline ||
+      BufferCapacity(&conn->outgoing.data) > kBufferBaseline ||
+      BufferCapacity(&conn->sending.data) > kBufferBaseline)
   {
-    msg("accept() error");
-    return -1;
+    DListInsertBefore(&gShard->bufferList, &conn->bufferNode);
   }
+}
 
+// Only empty buffers shrink; a non-empty sending buffer belongs to the kernel.
+static void connShrinkBuffers(Conn *conn)
+{
+  Buffer *buffers[] = {&conn->incoming, &conn->outgoing.data, &conn->sending.data};
+  for (Buffer *buf : buffers)
+  {
+    if (BufferSize(buf) == 0)
+    {
+      BufferShrink(buf, kBufferBaseline);
+    }
+  }
+}
+
+static Conn *connNew(int conn_fd, const struct sockaddr_in &client_addr)
+{
   uint32_t ip = client_addr.sin_addr.s_addr;
   fprintf(stderr, "New connection from: %u.%u.%u.%u:%u\n",
           ip & 255, (ip >> 8) & 255, (ip >> 16) & 255, (ip >> 24) & 255,
           ntohs(client_addr.sin_port));
 
   fdSetNonBlock(conn_fd);
+  // Replies are written as soon as a batch of requests is processed; Nagle
+  // would hold the tail of a pipeline back until the client's delayed ACK.
+  int val = 1;
+  setsockopt(conn_fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
 
   Conn *conn = new Conn();
   conn->fd = conn_fd;
+  conn->addr = client_addr;
   conn->want_read = true;
+  conn->events = EVENT_READ;
   conn->lastActiveMS = GetMonotonicMSec();
-  DListInsertBefore(&gData.idleList, &conn->idleNode);
+  TimerWheelAdd(&gShard->idleTimers, &conn->idleTimer, conn->lastActiveMS + kIdleTimeoutMS);
+  DListInit(&conn->bufferNode);
+
+  if (gShard->fd2conn.size() <= (size_t)conn->fd)
+  {
+    gShard->fd2conn.resize(conn->fd + 1);
+  }
+
+  assert(!gShard->fd2conn[conn->fd]);
+  gShard->fd2conn[conn->fd] = conn;
+  return conn;
+}
 
-  if (gData.fd2conn.size() <= (size_t)conn->fd)
+static int32_t handleAccept(int fd)
+{
+  struct sockaddr_in client_addr = {};
+  socklen_t client_len = sizeof(client_addr);
+  int conn_fd = accept(fd, (sockaddr *)&client_addr, &client_len);
+  if (conn_fd < 0)
   {
-    gData.fd2conn.resize(conn->fd + 1);
+    if (errno != EAGAIN)
+    {
+      msg("accept() error");
+    }
+    return -1;
   }
 
-  assert(!gData.fd2conn[conn->fd]);
-  gData.fd2conn[conn->fd] = conn;
+  Conn *conn = connNew(conn_fd, client_addr);
+  EventLoopAdd(&gShard->loop, conn->fd, conn->events);
   return 0;
 }
 
-static void handleWrite(Conn *conn)
+static void connUpdateEvents(Conn *conn)
 {
-  assert(conn->outgoing.size() > 0);
-  ssize_t rv = write(conn->fd, &conn->outgoing[0], conn->outgoing.size());
-  if (rv < 0)
+  if (gShard->uring)
   {
-    if (errno == EAGAIN)
-      return;
-    msg("write() error");
-    conn->want_close = true;
     return;
   }
 
-  consumeBuffer(conn->outgoing, (size_t)rv);
+  uint32_t events = 0;
+  if (conn->want_read)
+  {
+    events |= EVENT_READ;
+  }
+  if (conn->want_write)
+  {
+    events |= EVENT_WRITE;
+  }
+
+  if (events != conn->events)
+  {
+    EventLoopModify(&gShard->loop, conn->fd, events);
+    conn->events = events;
+  }
+}
+
+static void handleWrite(Conn *conn)
+{
+  assert(!OutgoingEmpty(&conn->outgoing));
+  // Edge-triggered readiness is only reported once, so drain until EAGAIN.
+  do
+  {
+    struct iovec iov[kMaxIovecs];
+    size_t n = OutgoingIovecs(&conn->outgoing, iov, kMaxIovecs);
+    ssize_t rv = writev(conn->fd, iov, (int)n);
+    if (rv < 0)
+    {
+      if (errno == EAGAIN)
+        return;
+      msg("write() error");
+      conn->want_close = true;
+      return;
+    }
+
+    OutgoingConsume(&conn->outgoing, (size_t)rv);
+  } while (EventLoopEdgeTriggered(&gShard->loop) && !OutgoingEmpty(&conn->outgoing));
 
-  if (conn->outgoing.size() == 0)
+  if (OutgoingEmpty(&conn->outgoing))
   {
     conn->want_write = false;
     conn->want_read = true;
   }
 }
 
+static void uringSend(Conn *conn);
+static void uringResumeRecv(Conn *conn);
+
+static void connProcess(Conn *conn)
+{
+  while (true)
+  {
+    while (try_one_request(conn))
+    {
+    }
+
+    if (gShard->uring)
+    {
+      return uringSend(conn);
+    }
+    if (OutgoingEmpty(&conn->outgoing))
+    {
+      return;
+    }
+
+    conn->want_read = 0;
+    conn->want_write = 1;
+    handleWrite(conn);
+    // A batch cut short by the soft limit continues once its replies are out.
+    if (conn->want_write || conn->want_close)
+    {
+      return;
+    }
+  }
+}
+
 static void handleRead(Conn *conn)
 {
-  uint8_t buf[64 * 1024];
-  ssize_t rv = read(conn->fd, buf, sizeof(buf));
-  if (rv < 0)
+  do
   {
-    if (errno == EAGAIN)
+    // Read straight into the tail of incoming, never past kMaxIncoming.
+    size_t size = BufferSize(&conn->incoming);
+    if (size >= kMaxIncoming)
+    {
       return;
-    msg("read() error");
-    conn->want_close = true;
+    }
+    BufferReserve(&conn->incoming, std::min(kReadMin, kMaxIncoming - size));
+    size_t room = std::min(BufferRoom(&conn->incoming), kMaxIncoming - size);
+    ssize_t rv = read(conn->fd, BufferTail(&conn->incoming), room);
+    if (rv < 0)
+    {
+      if (errno == EAGAIN)
+        return;
+      msg("read() error");
+      conn->want_close = true;
+      return;
+    }
+
+    if (rv == 0)
+    {
+      if (size == 0)
+      {
+        msg("Client is closed");
+      }
+      else
+      {
+        msg("unexpected EOF");
+      }
+
+      conn->want_close = true;
+      return;
+    }
+
+    BufferCommit(&conn->incoming, (size_t)rv);
+    connProcess(conn);
+  } while (EventLoopEdgeTriggered(&gShard->loop) && conn->want_read && !conn->want_close);
+}
+
+static void forwardRun(Forward *forward)
+{
+  std::vector<std::string_view> &cmd = gShard->args;
+  int32_t rv = parseReq(forward->request.data(), forward->request.size(), cmd);
+  assert(rv == 0);
+  (void)rv;
+
+  if (forward->allShards)
+  {
+    forward->count += forward->command->part(cmd, forward->reply);
+    if (--forward->hops > 0)
+    {
+      return shardSend(shardNext(gShard), forward);
+    }
+  }
+  else
+  {
+    doRequest(forward->command, cmd, forward->reply);
+  }
+
+  forward->done = true;
+  shardSend(forward->origin, forward);
+}
+
+static void forwardDone(Forward *forward)
+{
+  Conn *conn = forward->conn;
+  conn->forwarding = false;
+  if (conn->fd < 0)
+  {
+    connRelease(conn);
+    delete forward;
+    return;
+  }
+
+  size_t header_pos = 0;
+  responseBegin(conn->outgoing, &header_pos);
+  if (forward->allShards)
+  {
+    outputArray(conn->outgoing, forward->count);
+  }
+  OutgoingMove(&conn->outgoing, &forward->reply);
+  responseEnd(conn->outgoing, header_pos);
+  delete forward;
+
+  connCheckOutput(conn);
+  connProcess(conn);
+  if (gShard->uring)
+  {
+    uringResumeRecv(conn);
+  }
+  if (!gShard->uring && EventLoopEdgeTriggered(&gShard->loop) && conn->want_read && !conn->want_close)
+  {
+    // Reading may have stopped at kMaxIncoming; no new edge will come.
+    handleRead(conn);
+  }
+  if (conn->want_close)
+  {
+    return connDestroy(conn);
+  }
+  connTouch(conn);
+  connTrackBuffers(conn);
+  connUpdateEvents(conn);
+}
+
+static void shardDrainMailbox()
+{
+  if (!gShard->wakePending.exchange(false))
+  {
     return;
   }
 
-  if (rv == 0)
+  while (MailboxNode *node = MailboxPop(&gShard->mailbox))
   {
-    if (conn->incoming.size() == 0)
+    Forward *forward = containerOf(node, Forward, node);
+    if (forward->done)
     {
-      msg("Client is closed");
+      forwardDone(forward);
     }
     else
     {
-      msg("unexpected EOF");
+      forwardRun(forward);
     }
+  }
+}
 
-    conn->want_close = true;
+enum
+{
+  URING_ACCEPT = 1,
+  URING_WAKE,
+  URING_RECV,
+  URING_SEND,
+  URING_CANCEL,
+};
+
+// user_data carries the operation in the low bits of the Conn pointer, so a
+// completion never resolves through a fd that may have been reused.
+static uint64_t uringData(uint32_t op, Conn *conn)
+{
+  return (uint64_t)(uintptr_t)conn | op;
+}
+
+static void uringArmAccept()
+{
+  io_uring_sqe *sqe = IoUringGetSqe(&gShard->ring);
+  IoUringPrepAcceptMultishot(sqe, gShard->listenFd);
+  sqe->user_data = uringData(URING_ACCEPT, NULL);
+}
+
+static void uringArmWake()
+{
+  io_uring_sqe *sqe = IoUringGetSqe(&gShard->ring);
+  IoUringPrepRead(sqe, gShard->wakeFd, &gShard->wakeCount, sizeof(gShard->wakeCount));
+  sqe->user_data = uringData(URING_WAKE, NULL);
+}
+
+static void uringArmRecv(Conn *conn)
+{
+  io_uring_sqe *sqe = IoUringGetSqe(&gShard->ring);
+  IoUringPrepRecvMultishot(sqe, conn->fd, kUringBufGroup);
+  sqe->user_data = uringData(URING_RECV, conn);
+  conn->inflight++;
+  conn->recvArmed = true;
+}
+
+// Multishot recv keeps filling incoming on its own, so a paused connection
+// cancels it and re-arms once it may read again.
+static void uringPauseRecv(Conn *conn)
+{
+  if (!conn->recvArmed || conn->recvCancel || !connReadPaused(conn))
+  {
+    return;
+  }
+  io_uring_sqe *sqe = IoUringGetSqe(&gShard->ring);
+  IoUringPrepCancel(sqe, uringData(URING_RECV, conn));
+  sqe->user_data = uringData(URING_CANCEL, conn);
+  conn->inflight++;
+  conn->recvCancel = true;
+}
+
+static void uringResumeRecv(Conn *conn)
+{
+  if (conn->fd >= 0 && !conn->recvArmed && !connReadPaused(conn))
+  {
+    uringArmRecv(conn);
+  }
+}
+
+// The iovecs and msghdr live in the Conn until the kernel is done with them.
+static void uringSubmitSend(Conn *conn)
+{
+  conn->sendIov.resize(kMaxIovecs);
+  size_t n = OutgoingIovecs(&conn->sending, conn->sendIov.data(), kMaxIovecs);
+  conn->sendMsg = {};
+  conn->sendMsg.msg_iov = conn->sendIov.data();
+  conn->sendMsg.msg_iovlen = n;
+
+  io_uring_sqe *sqe = IoUringGetSqe(&gShard->ring);
+  IoUringPrepSendmsg(sqe, conn->fd, &conn->sendMsg);
+  sqe->user_data = uringData(URING_SEND, conn);
+  conn->inflight++;
+}
+
+// At most one send is in flight. Replies produced meanwhile collect in
+// outgoing and are swapped in when the current send completes.
+static void uringSend(Conn *conn)
+{
+  if (conn->fd < 0 || !OutgoingEmpty(&conn->sending) || OutgoingEmpty(&conn->outgoing))
+  {
     return;
   }
 
-  appendBuffer(conn->incoming, buf, (size_t)rv);
+  OutgoingSwap(&conn->sending, &conn->outgoing);
+  uringSubmitSend(conn);
+}
 
-  while (try_one_request(conn))
+static void uringHandleAccept(io_uring_cqe *cqe)
+{
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+  {
+    uringArmAccept();
+  }
+  if (cqe->res < 0)
   {
+    errno = -cqe->res;
+    msg("accept() error");
+    return;
   }
 
-  if (conn->outgoing.size() > 0)
+  struct sockaddr_in client_addr = {};
+  socklen_t client_len = sizeof(client_addr);
+  getpeername(cqe->res, (sockaddr *)&client_addr, &client_len);
+  Conn *conn = connNew(cqe->res, client_addr);
+  uringArmRecv(conn);
+}
+
+static void uringHandleRecv(Conn *conn, io_uring_cqe *cqe)
+{
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  if (!more)
   {
-    conn->want_read = 0;
-    conn->want_write = 1;
-    return handleWrite(conn);
+    conn->inflight--;
+    conn->recvArmed = false;
+  }
+
+  if (cqe->flags & IORING_CQE_F_BUFFER)
+  {
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (conn->fd >= 0 && cqe->res > 0)
+    {
+      BufferAppend(&conn->incoming, IoUringBuffer(&gShard->ring, bid), (size_t)cqe->res);
+    }
+    IoUringRecycleBuffer(&gShard->ring, bid);
+  }
+
+  if (conn->fd < 0)
+  {
+    return connRelease(conn);
+  }
+
+  if (cqe->res > 0)
+  {
+    connTouch(conn);
+    connProcess(conn);
+  }
+  else if (cqe->res == 0)
+  {
+    msg(BufferSize(&conn->incoming) == 0 ? "Client is closed" : "unexpected EOF");
+    conn->want_close = true;
+  }
+  else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+  {
+    errno = -cqe->res;
+    msg("recv() error");
+    conn->want_close = true;
+  }
+
+  if (conn->want_close)
+  {
+    return connDestroy(conn);
+  }
+  connTrackBuffers(conn);
+  // Out of provided buffers, cancelled or terminated by the kernel; buffers
+  // are recycled as each completion is consumed, so re-arming is safe.
+  uringResumeRecv(conn);
+  uringPauseRecv(conn);
+}
+
+static void uringHandleSend(Conn *conn, io_uring_cqe *cqe)
+{
+  conn->inflight--;
+  if (conn->fd < 0)
+  {
+    OutgoingClear(&conn->sending);
+    return connRelease(conn);
   }
+
+  if (cqe->res < 0)
+  {
+    errno = -cqe->res;
+    msg("send() error");
+    return connDestroy(conn);
+  }
+
+  OutgoingConsume(&conn->sending, (size_t)cqe->res);
+  if (!OutgoingEmpty(&conn->sending))
+  {
+    return uringSubmitSend(conn);
+  }
+  // Requests held back by the soft limit run now that replies drained.
+  connProcess(conn);
+  if (conn->want_close)
+  {
+    return connDestroy(conn);
+  }
+  uringResumeRecv(conn);
+  connTrackBuffers(conn);
+}
+
+static void uringHandleCancel(Conn *conn)
+{
+  conn->inflight--;
+  conn->recvCancel = false;
+  if (conn->fd < 0)
+  {
+    return connRelease(conn);
+  }
+}
+
+static void uringHandleCqe(io_uring_cqe *cqe)
+{
+  uint32_t op = (uint32_t)(cqe->user_data & 7);
+  Conn *conn = (Conn *)(uintptr_t)(cqe->user_data & ~(uint64_t)7);
+  switch (op)
+  {
+  case URING_ACCEPT:
+    return uringHandleAccept(cqe);
+  case URING_WAKE:
+    return uringArmWake();
+  case URING_RECV:
+    return uringHandleRecv(conn, cqe);
+  case URING_SEND:
+    return uringHandleSend(conn, cqe);
+  case URING_CANCEL:
+    return uringHandleCancel(conn);
+  default:
+    assert(!"unknown io_uring operation");
+  }
+}
+
+static bool shardInitUring(Shard *shard)
+{
+  if (!IoUringInit(&shard->ring, kUringEntries))
+  {
+    return false;
+  }
+  if (!IoUringSetupBuffers(&shard->ring, kUringBufCount, kUringBufSize, kUringBufGroup))
+  {
+    IoUringClose(&shard->ring);
+    return false;
+  }
+  shard->uring = true;
+  return true;
 }
 
 static int32_t nextTimerMS()
 {
-  uint64_t nextMS = (size_t)-1;
-  if (!DListEmpty(&gData.idleList))
+  uint64_t nextMS = std::min(TimerWheelNextMS(&gShard->idleTimers),
+                             TimerWheelNextMS(&gShard->keyTimers));
+  if (!DListEmpty(&gShard->bufferList))
   {
-    return -1;
-    Conn *conn = containerOf(gData.idleList.next, Conn, idleNode);
-    nextMS = conn->lastActiveMS + kIdleTimeoutMS;
+    Conn *conn = containerOf(gShard->bufferList.next, Conn, bufferNode);
+    nextMS = std::min(nextMS, conn->lastActiveMS + kBufferIdleMS);
   }
 
   uint64_t nowMS = GetMonotonicMSec();
 
-  if (!gData.heap.empty() && gData.heap[0].val < nextMS)
+  if (HashMapRehashPending())
   {
-    nextMS = gData.heap[0].val;
+    // Keep polling while idle passes have resizes to finish.
+    return 0;
   }
-
   if (nextMS == (size_t)-1)
   {
     return -1;
@@ -872,42 +1885,194 @@ static int32_t nextTimerMS()
   return (int32_t)(nextMS - nowMS);
 }
 
-static void processTimers()
+// Expires due keys within the shard's budget. The budget doubles while a
+// backlog remains and the loop has time to spare (the last wait found
+// nothing to serve), and decays back once the backlog is gone; a pass never
+// runs past kExpireMaxMS.
+static void expireKeys(uint64_t nowMS, bool idle)
 {
-  uint64_t nowMS = GetMonotonicMSec();
-  while (!DListEmpty(&gData.idleList))
+  size_t budget = std::max(gShard->expireBudget, kExpireMinWork);
+  size_t done = 0;
+  while (done < budget)
+  {
+    TimerNode *timer = TimerWheelPop(&gShard->keyTimers, nowMS);
+    if (!timer)
+    {
+      break;
+    }
+    entryEvict(containerOf(timer, Entry, ttl));
+    if (++done % 256 == 0 && GetMonotonicMSec() - nowMS >= kExpireMaxMS)
+    {
+      break;
+    }
+  }
+
+  bool backlog = TimerWheelNextMS(&gShard->keyTimers) <= nowMS;
+  if (backlog && idle)
+  {
+    budget = std::min(budget * 2, kExpireMaxWork);
+  }
+  else if (!backlog)
+  {
+    budget = std::max(budget / 2, kExpireMinWork);
+  }
+  gShard->expireBudget = budget;
+}
+
+// Finishes resizes for up to kRehashIdleNS, then sizes the step each
+// command takes on its own map so that it costs about kRehashStepNS.
+static void rehashInBackground()
+{
+  if (!HashMapRehashPending())
+  {
+    return;
+  }
+  uint64_t start = GetMonotonicNSec();
+  uint64_t elapsed = 0;
+  size_t done = 0;
+  while (true)
   {
-    Conn *conn = containerOf(gData.idleList.next, Conn, idleNode);
-    uint64_t nextMS = conn->lastActiveMS + kIdleTimeoutMS;
-    if (nextMS >= nowMS)
+    size_t n = HashMapRehashBackground(kRehashBatch);
+    done += n;
+    elapsed = GetMonotonicNSec() - start;
+    if (n < kRehashBatch || elapsed >= kRehashIdleNS)
     {
       break;
     }
+  }
+  if (done < kRehashBatch)
+  {
+    // Too little to time.
+    return;
+  }
+
+  double unitNS = double(elapsed) / done;
+  double &avg = gShard->rehashUnitNS;
+  avg = avg > 0 ? (avg * 3 + unitNS) / 4 : unitNS;
+  size_t step = (size_t)(kRehashStepNS / avg);
+  gHashMapStepWork = std::min(std::max(step, kRehashMinStep), kRehashMaxStep);
+}
+
+static void processTimers(bool idle)
+{
+  uint64_t nowMS = GetMonotonicMSec();
+  while (TimerNode *timer = TimerWheelPop(&gShard->idleTimers, nowMS))
+  {
+    Conn *conn = containerOf(timer, Conn, idleTimer);
     fprintf(stderr, "removing idle connection: %d\n", conn->fd);
     connDestroy(conn);
   }
 
-  const size_t kMaxWork = 2000;
-  size_t nworks = 0;
-  const std::vector<HeapItem> &heap = gData.heap;
-  while (!heap.empty() && heap[0].val < nowMS)
+  while (!DListEmpty(&gShard->bufferList))
   {
-    Entry *entry = containerOf(heap[0].ref, Entry, heapIndex);
-    HNode *node = HashMapDelete(&gData.database, &entry->node, [](HNode *node, HNode *key)
-                                { return node == key; });
-    assert(node == &entry->node);
-    entryDelete(entry);
-    if (nworks++ >= kMaxWork)
+    Conn *conn = containerOf(gShard->bufferList.next, Conn, bufferNode);
+    if (conn->lastActiveMS + kBufferIdleMS >= nowMS)
     {
       break;
     }
+    connShrinkBuffers(conn);
+    DListDetach(&conn->bufferNode);
+    DListInit(&conn->bufferNode);
+  }
+
+  expireKeys(nowMS, idle);
+  if (idle)
+  {
+    rehashInBackground();
   }
 }
 
-int main()
+// Bytes with an optional k/m/g suffix.
+static bool parseSize(const char *s, size_t *out)
+{
+  char *end = NULL;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (end == s)
+  {
+    return false;
+  }
+  switch (*end)
+  {
+  case 'g':
+  case 'G':
+    n <<= 10;
+    [[fallthrough]];
+  case 'm':
+  case 'M':
+    n <<= 10;
+    [[fallthrough]];
+  case 'k':
+  case 'K':
+    n <<= 10;
+    end++;
+    break;
+  }
+  *out = (size_t)n;
+  return *end == 0;
+}
+
+static void parseArgs(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--event-loop") == 0 && i + 1 < argc)
+    {
+      if (!EventLoopParseBackend(argv[++i], &gConfig.eventLoop))
+      {
+        fprintf(stderr, "unknown event loop: %s\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "--io-uring") == 0)
+    {
+      gConfig.ioUring = true;
+    }
+    else if (strcmp(argv[i], "--hash-engine") == 0 && i + 1 < argc)
+    {
+      if (!HashMapParseEngine(argv[++i], &gConfig.hashEngine))
+      {
+        fprintf(stderr, "unknown hash engine: %s\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      gConfig.threads = (size_t)atol(argv[++i]);
+      if (gConfig.threads == 0 || gConfig.threads > kMaxThreads)
+      {
+        fprintf(stderr, "bad thread count: %s\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if (strcmp(argv[i], "--output-limit") == 0 && i + 3 < argc)
+    {
+      const char *name = argv[++i];
+      size_t cls = 0;
+      while (cls < CONN_CLASS_COUNT && strcmp(kConnClassNames[cls], name) != 0)
+      {
+        cls++;
+      }
+      OutputLimit limit;
+      if (cls == CONN_CLASS_COUNT || !parseSize(argv[i + 1], &limit.soft) ||
+          !parseSize(argv[i + 2], &limit.hard) || limit.soft > limit.hard)
+      {
+        fprintf(stderr, "bad output limit: %s %s %s\n", name, argv[i + 1], argv[i + 2]);
+        exit(1);
+      }
+      gConfig.outputLimits[cls] = limit;
+      i += 2;
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [--event-loop poll|epoll|epoll-et] [--io-uring] [--threads N] "
+                      "[--hash-engine chained|swiss] [--output-limit normal SOFT HARD]\n", argv[0]);
+      exit(1);
+    }
+  }
+}
+
+static int listenNew()
 {
-  DListInit(&gData.idleList);
-  ThreadPoolInit(&gData.threadPool, 4);
   // AF_INET = Ip4
   // AF_INET6 = Ip6
   // SOCK_STREAM = TCP
@@ -921,6 +2086,9 @@ int main()
   int val = 1;
   // SO_REUSEADDR to be able to reconnect to the same port
   setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+  // SO_REUSEPORT lets every shard bind its own listener; the kernel spreads
+  // new connections across them.
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
   struct sockaddr_in addr = {};
   addr.sin_family = AF_INET;
   addr.sin_port = htons(1234);
@@ -939,77 +2107,173 @@ int main()
   {
     die("Listen()");
   }
+  return fd;
+}
 
-  std::vector<struct pollfd> poll_args;
+static Shard *shardNew(size_t id)
+{
+  Shard *shard = new Shard();
+  shard->id = id;
+  shard->stats.resize(kCommandCount);
+  shard->database.engine = gConfig.hashEngine;
+  MailboxInit(&shard->mailbox);
+  DListInit(&shard->bufferList);
+  TimerWheelInit(&shard->idleTimers, GetMonotonicMSec());
+  TimerWheelInit(&shard->keyTimers, GetMonotonicMSec());
 
-  while (true)
+  shard->listenFd = listenNew();
+  shard->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (shard->wakeFd < 0)
   {
-    poll_args.clear();
+    die("eventfd()");
+  }
 
-    struct pollfd pfd = {fd, POLLIN, 0};
+  if (gConfig.ioUring)
+  {
+    if (shardInitUring(shard))
+    {
+      return shard;
+    }
+    msg("io_uring unavailable, falling back to the event loop");
+  }
 
-    poll_args.push_back(pfd);
+  if (!EventLoopInit(&shard->loop, gConfig.eventLoop))
+  {
+    msg("epoll_create1() error, falling back to poll");
+  }
+  EventLoopAdd(&shard->loop, shard->listenFd, EVENT_READ);
+  EventLoopAdd(&shard->loop, shard->wakeFd, EVENT_READ);
+  return shard;
+}
 
-    for (Conn *conn : gData.fd2conn)
+static void shardRunUring()
+{
+  uringArmAccept();
+  uringArmWake();
+  while (true)
+  {
+    int32_t timeoutMS = nextTimerMS();
+    // Submits every operation queued during the previous pass in one call.
+    int rv = IoUringSubmitAndWait(&gShard->ring, timeoutMS);
+    if (rv < 0 && rv != -ETIME && rv != -EINTR && rv != -EBUSY)
     {
-      if (!conn)
-        continue;
-      struct pollfd pfd = {conn->fd, POLLERR, 0};
-
-      if (conn->want_read)
-        pfd.events |= POLLIN;
-      if (conn->want_write)
-        pfd.events |= POLLOUT;
+      errno = -rv;
+      die("io_uring_enter() error");
+    }
 
-      poll_args.push_back(pfd);
+    size_t completions = 0;
+    while (io_uring_cqe *cqe = IoUringPeekCqe(&gShard->ring))
+    {
+      io_uring_cqe copy = *cqe;
+      IoUringCqeSeen(&gShard->ring);
+      uringHandleCqe(&copy);
+      completions++;
     }
+    shardDrainMailbox();
+    processTimers(completions == 0);
+  }
+}
+
+static void *shardMain(void *arg)
+{
+  gShard = (Shard *)arg;
+  if (gShard->uring)
+  {
+    shardRunUring();
+    return NULL;
+  }
 
+  while (true)
+  {
     int32_t timeoutMS = nextTimerMS();
     // Wait for a connections
-    int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), timeoutMS);
+    int rv = EventLoopWait(&gShard->loop, timeoutMS);
     if (rv < 0)
     {
       if (errno == EINTR)
         continue;
-      die("poll() error");
-    }
-
-    // If there's a new connections, create a Conn object
-    if (poll_args[0].revents)
-    {
-      handleAccept(fd);
+      die("EventLoopWait() error");
     }
 
-    // Handle the connection messages.
-    for (size_t i = 1; i < poll_args.size(); i++)
+    // Only the ready fds are visited; interest changes are pushed to the
+    // backend through connUpdateEvents() instead of rebuilding a pollfd list.
+    for (const Event &ev : gShard->loop.ready)
     {
-      uint32_t ready = poll_args[i].revents;
-      if (!ready)
+      // If there's a new connections, create a Conn object
+      if (ev.fd == gShard->listenFd)
+      {
+        while (handleAccept(ev.fd) == 0)
+        {
+        }
         continue;
+      }
+      if (ev.fd == gShard->wakeFd)
+      {
+        uint64_t count = 0;
+        ssize_t rv = read(ev.fd, &count, sizeof(count));
+        (void)rv;
+        continue;
+      }
 
-      Conn *conn = gData.fd2conn[poll_args[i].fd];
-
-      conn->lastActiveMS = GetMonotonicMSec();
-      DListDetach(&conn->idleNode);
-      DListInsertBefore(&gData.idleList, &conn->idleNode);
+      Conn *conn = gShard->fd2conn[ev.fd];
+      connTouch(conn);
 
-      if (ready & POLLIN)
+      if (ev.events & EVENT_READ)
       {
         assert(conn->want_read);
         handleRead(conn);
       }
-      if (ready & POLLOUT)
+      if ((ev.events & EVENT_WRITE) && conn->want_write)
       {
-        assert(conn->want_write);
         handleWrite(conn);
+        if (!conn->want_write && !conn->want_close)
+        {
+          // Run requests held back by the soft limit.
+          connProcess(conn);
+        }
       }
 
-      if ((ready & POLLERR) || conn->want_close)
+      if ((ev.events & EVENT_ERROR) || conn->want_close)
       {
         connDestroy(conn);
       }
+      else
+      {
+        connTrackBuffers(conn);
+        connUpdateEvents(conn);
+      }
     }
-    processTimers();
+    shardDrainMailbox();
+    processTimers(gShard->loop.ready.empty());
   }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  parseArgs(argc, argv);
+  HashSeedInit();
+  // A peer that disconnects with replies pending must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+  ThreadPoolInit(&gData.threadPool, 4);
+
+  for (size_t i = 0; i < gConfig.threads; i++)
+  {
+    gData.shards.push_back(shardNew(i));
+  }
+  fprintf(stderr, "event loop: %s, threads: %zu, hash engine: %s\n",
+          gData.shards[0]->uring ? "io_uring" : EventLoopBackendName(gData.shards[0]->loop.backend),
+          gData.shards.size(), HashMapEngineName(gConfig.hashEngine));
+
+  for (size_t i = 1; i < gData.shards.size(); i++)
+  {
+    Shard *shard = gData.shards[i];
+    int rv = pthread_create(&shard->thread, NULL, &shardMain, shard);
+    if (rv != 0)
+    {
+      die("pthread_create()");
+    }
+  }
+  shardMain(gData.shards[0]);
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,345 @@
+#include <assert.h>
+#include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "swisstable.h"
+
+// Slots come in groups of 16 whose control bytes are compared at once: a
+// full slot holds 0x80 | 7 bits of its hash, so a probe touches one cache
+// line of control bytes and usually dereferences only the node it is
+// looking for. Empty is zero, so a new table comes from calloc() without a
+// memset of the whole control array stalling the insert that grew it.
+const size_t kGroupWidth = 16;
+const uint8_t kCtrlEmpty = 0x00;
+const uint8_t kCtrlDeleted = 0x01;
+const size_t kMinCapacity = kGroupWidth;
+
+// Callers may hand in weak hcodes; spread them over 64 bits first.
+static uint64_t swissHash(uint64_t hcode)
+{
+  uint64_t h = hcode * 0x9E3779B97F4A7C15;
+  return h ^ (h >> 29);
+}
+
+static uint8_t swissH2(uint64_t h)
+{
+  return (uint8_t)(0x80 | (h >> 57));
+}
+
+// Bit i set when control byte i of the group equals b.
+static uint32_t groupMatch(const uint8_t *group, uint8_t b)
+{
+#if defined(__SSE2__)
+  __m128i ctrl = _mm_load_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < kGroupWidth; i++)
+  {
+    mask |= (uint32_t)(group[i] == b) << i;
+  }
+  return mask;
+#endif
+}
+
+// Bit i set when slot i of the group holds a node (top bit of its control
+// byte set).
+static uint32_t groupMatchFull(const uint8_t *group)
+{
+#if defined(__SSE2__)
+  return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < kGroupWidth; i++)
+  {
+    mask |= (uint32_t)(group[i] >> 7) << i;
+  }
+  return mask;
+#endif
+}
+
+static uint32_t groupMatchFree(const uint8_t *group)
+{
+  return ~groupMatchFull(group) & ((1u << kGroupWidth) - 1);
+}
+
+static void init(HTab *htab, size_t n)
+{
+  assert(n >= kMinCapacity && ((n - 1) & n) == 0);
+  // malloc() alignment covers a group.
+  htab->ctrl = (uint8_t *)calloc(n, 1);
+  htab->bucket = (HNode **)malloc(n * sizeof(HNode *));
+  if (!htab->ctrl || !htab->bucket)
+  {
+    abort();
+  }
+  htab->mask = n - 1;
+  htab->size = 0;
+  htab->tombstones = 0;
+}
+
+static void release(HTab *htab)
+{
+  free(htab->ctrl);
+  free(htab->bucket);
+  *htab = HTab{};
+}
+
+// Groups are probed in triangular order, which visits every group of a
+// power-of-two table. Probing stops at the first group with an empty slot.
+static size_t lookup(HTab *htab, HNode *key, bool (*eq)(HNode *, HNode *), uint64_t h)
+{
+  if (!htab->ctrl)
+  {
+    return (size_t)-1;
+  }
+  size_t groupMask = htab->mask / kGroupWidth;
+  size_t group = (size_t)h & groupMask;
+  uint8_t h2 = swissH2(h);
+  for (size_t probe = 1;; probe++)
+  {
+    const uint8_t *ctrl = htab->ctrl + group * kGroupWidth;
+    for (uint32_t match = groupMatch(ctrl, h2); match; match &= match - 1)
+    {
+      size_t pos = group * kGroupWidth + __builtin_ctz(match);
+      HNode *node = htab->bucket[pos];
+      if (node->hcode == key->hcode && eq(node, key))
+      {
+        return pos;
+      }
+    }
+    if (groupMatch(ctrl, kCtrlEmpty))
+    {
+      return (size_t)-1;
+    }
+    group = (group + probe) & groupMask;
+  }
+}
+
+static void insert(HTab *htab, HNode *node)
+{
+  uint64_t h = swissHash(node->hcode);
+  size_t groupMask = htab->mask / kGroupWidth;
+  size_t group = (size_t)h & groupMask;
+  for (size_t probe = 1;; probe++)
+  {
+    uint32_t room = groupMatchFree(htab->ctrl + group * kGroupWidth);
+    if (room)
+    {
+      size_t pos = group * kGroupWidth + __builtin_ctz(room);
+      if (htab->ctrl[pos] == kCtrlDeleted)
+      {
+        htab->tombstones--;
+      }
+      htab->ctrl[pos] = swissH2(h);
+      htab->bucket[pos] = node;
+      htab->size++;
+      return;
+    }
+    group = (group + probe) & groupMask;
+  }
+}
+
+// A slot may go back to empty only if its group already has an empty slot:
+// then no probe ever continued past this group.
+static HNode *detach(HTab *htab, size_t pos)
+{
+  const uint8_t *ctrl = htab->ctrl + (pos & ~(kGroupWidth - 1));
+  if (groupMatch(ctrl, kCtrlEmpty))
+  {
+    htab->ctrl[pos] = kCtrlEmpty;
+  }
+  else
+  {
+    htab->ctrl[pos] = kCtrlDeleted;
+    htab->tombstones++;
+  }
+  htab->size--;
+  return htab->bucket[pos];
+}
+
+// Keeps at least one empty slot per probe sequence: 7/8 of the slots at
+// most hold nodes or tombstones, counting the pending nodes still to move in.
+static bool full(HTab *htab, size_t pending)
+{
+  size_t cap = htab->mask + 1;
+  return htab->size + htab->tombstones + pending + 1 > cap - cap / 8;
+}
+
+static bool forEach(HTab *htab, bool (*f)(HNode *, void *), void *arg)
+{
+  for (size_t i = 0; htab->ctrl && i <= htab->mask; i += kGroupWidth)
+  {
+    uint32_t used = groupMatchFull(htab->ctrl + i);
+    for (; used; used &= used - 1)
+    {
+      if (!f(htab->bucket[i + __builtin_ctz(used)], arg))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Work is counted in moved nodes plus scanned groups.
+size_t SwissHelpRehashing(HMap *hmap, size_t work)
+{
+  HTab *older = &hmap->older;
+  size_t nwork = 0;
+  while (nwork < work && older->size > 0)
+  {
+    assert(hmap->migrate_pos <= older->mask);
+    uint8_t *ctrl = older->ctrl + hmap->migrate_pos;
+    uint32_t used = groupMatchFull(ctrl);
+    for (; used; used &= used - 1)
+    {
+      size_t pos = hmap->migrate_pos + __builtin_ctz(used);
+      // Lookups may still probe through this group until older is gone.
+      ctrl[pos - hmap->migrate_pos] = kCtrlDeleted;
+      older->size--;
+      insert(&hmap->newer, older->bucket[pos]);
+      nwork++;
+    }
+    hmap->migrate_pos += kGroupWidth;
+    nwork++;
+  }
+
+  if (older->size == 0 && older->ctrl)
+  {
+    release(older);
+    HashMapDequeue(hmap);
+  }
+  return nwork;
+}
+
+static void finishRehashing(HMap *hmap)
+{
+  while (hmap->older.ctrl)
+  {
+    SwissHelpRehashing(hmap, gHashMapStepWork);
+  }
+}
+
+// Moves the nodes to a table of n slots, a bit on each operation.
+static void triggerRehashing(HMap *hmap, size_t n)
+{
+  assert(!hmap->older.ctrl);
+  hmap->older = hmap->newer;
+  init(&hmap->newer, n);
+  hmap->migrate_pos = 0;
+  HashMapEnqueue(hmap);
+}
+
+// Doubles when live nodes fill most of the table; otherwise the slots are
+// mostly tombstones and a same-size copy clears them.
+static void grow(HMap *hmap)
+{
+  finishRehashing(hmap);
+  size_t cap = hmap->newer.mask + 1;
+  triggerRehashing(hmap, hmap->newer.size >= cap / 2 - cap / 16 ? cap * 2 : cap);
+}
+
+// Below 1/8 full, moves to a table 1/4 to 1/2 full. Growth happens at 7/8,
+// so a size change needs the keyspace to double or drop by 3/4 first. A
+// shrink may still be migrating when inserts fill the small table; full()
+// counts the nodes left in older so that they always fit.
+static void maybeShrink(HMap *hmap)
+{
+  size_t cap = hmap->newer.mask + 1;
+  if (hmap->older.ctrl || cap <= kMinCapacity || hmap->newer.size >= cap / 8)
+  {
+    return;
+  }
+  size_t target = kMinCapacity;
+  while (target < hmap->newer.size * 2)
+  {
+    target *= 2;
+  }
+  triggerRehashing(hmap, target);
+}
+
+size_t SwissHomeMask(HTab *htab)
+{
+  return htab->mask / kGroupWidth;
+}
+
+// Follows the probe sequence from the home group as far as a lookup would,
+// picking out the nodes that started there.
+void SwissScanHome(HTab *htab, size_t home, void (*f)(HNode *, void *), void *arg)
+{
+  size_t groupMask = htab->mask / kGroupWidth;
+  size_t group = home;
+  for (size_t probe = 1;; probe++)
+  {
+    const uint8_t *ctrl = htab->ctrl + group * kGroupWidth;
+    for (uint32_t used = groupMatchFull(ctrl); used; used &= used - 1)
+    {
+      HNode *node = htab->bucket[group * kGroupWidth + __builtin_ctz(used)];
+      if ((swissHash(node->hcode) & groupMask) == home)
+      {
+        f(node, arg);
+      }
+    }
+    if (groupMatch(ctrl, kCtrlEmpty))
+    {
+      return;
+    }
+    group = (group + probe) & groupMask;
+  }
+}
+
+HNode *SwissLookup(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
+{
+  SwissHelpRehashing(hmap, gHashMapStepWork);
+  uint64_t h = swissHash(key->hcode);
+  size_t pos = lookup(&hmap->newer, key, eq, h);
+  if (pos != (size_t)-1)
+  {
+    return hmap->newer.bucket[pos];
+  }
+  pos = lookup(&hmap->older, key, eq, h);
+  return pos != (size_t)-1 ? hmap->older.bucket[pos] : NULL;
+}
+
+void SwissInsert(HMap *hmap, HNode *node)
+{
+  if (!hmap->newer.ctrl)
+  {
+    init(&hmap->newer, kMinCapacity);
+  }
+  if (full(&hmap->newer, hmap->older.size))
+  {
+    grow(hmap);
+  }
+  insert(&hmap->newer, node);
+  SwissHelpRehashing(hmap, gHashMapStepWork);
+}
+
+HNode *SwissDelete(HMap *hmap, HNode *key, bool (*eq)(HNode *, HNode *))
+{
+  SwissHelpRehashing(hmap, gHashMapStepWork);
+  uint64_t h = swissHash(key->hcode);
+  size_t pos = lookup(&hmap->newer, key, eq, h);
+  if (pos != (size_t)-1)
+  {
+    HNode *node = detach(&hmap->newer, pos);
+    maybeShrink(hmap);
+    return node;
+  }
+  pos = lookup(&hmap->older, key, eq, h);
+  return pos != (size_t)-1 ? detach(&hmap->older, pos) : NULL;
+}
+
+void SwissClear(HMap *hmap)
+{
+  release(&hmap->newer);
+  release(&hmap->older);
+  hmap->migrate_pos = 0;
+}
+
+void SwissForEach(HMap *hmap, bool (*f)(HNode *, void *), void *arg)
+{
+  forEach(&hmap->newer, f, arg) && forEach(&hmap->older, f, arg);
+}
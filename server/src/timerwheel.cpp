@@ -0,0 +1,180 @@
+#include <assert.h>
+
+#include "common.h"
+#include "timerwheel.h"
+
+void TimerWheelInit(TimerWheel *wheel, uint64_t nowMS)
+{
+  wheel->now = nowMS;
+  wheel->count = 0;
+  for (uint32_t level = 0; level < kWheelLevels; level++)
+  {
+    wheel->occupied[level] = 0;
+    for (uint32_t slot = 0; slot < kWheelSlots; slot++)
+    {
+      DListInit(&wheel->slots[level][slot]);
+    }
+  }
+  DListInit(&wheel->due);
+}
+
+static void wheelUnlink(TimerNode *node)
+{
+  DListDetach(&node->link);
+  node->link.prev = node->link.next = NULL;
+}
+
+// Links node where it belongs relative to wheel->now. Level 0 slots at or
+// after the current tick, and higher-level slots strictly after it, all
+// start within the current rotation of the level above, so no slot ever
+// mixes two rotations.
+static void wheelPlace(TimerWheel *wheel, TimerNode *node)
+{
+  if (node->expireAt < wheel->now)
+  {
+    DListInsertBefore(&wheel->due, &node->link);
+    return;
+  }
+  uint64_t diff = node->expireAt ^ wheel->now;
+  uint32_t level = diff ? (63 - __builtin_clzll(diff)) / kWheelBits : 0;
+  uint32_t slot = (uint32_t)(node->expireAt >> (level * kWheelBits)) & (kWheelSlots - 1);
+  DListInsertBefore(&wheel->slots[level][slot], &node->link);
+  wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+void TimerWheelAdd(TimerWheel *wheel, TimerNode *node, uint64_t expireAt)
+{
+  if (TimerArmed(node))
+  {
+    DListDetach(&node->link);
+  }
+  else
+  {
+    wheel->count++;
+  }
+  node->expireAt = expireAt;
+  wheelPlace(wheel, node);
+}
+
+void TimerWheelCancel(TimerWheel *wheel, TimerNode *node)
+{
+  if (TimerArmed(node))
+  {
+    wheelUnlink(node);
+    wheel->count--;
+  }
+}
+
+// Start of the first occupied slot of a level, or UINT64_MAX.
+static uint64_t wheelLevelNext(const TimerWheel *wheel, uint32_t level)
+{
+  uint32_t shift = level * kWheelBits;
+  uint32_t cur = (uint32_t)(wheel->now >> shift) & (kWheelSlots - 1);
+  // The current slot counts: at level 0 it holds the current tick, and a
+  // higher level's current slot is occupied only when now sits on its start.
+  uint64_t mask = wheel->occupied[level] & (~(uint64_t)0 << cur);
+  if (!mask)
+  {
+    return UINT64_MAX;
+  }
+  uint64_t slot = (uint64_t)__builtin_ctzll(mask);
+  uint32_t rotation = shift + kWheelBits;
+  uint64_t base = rotation >= 64 ? 0 : (wheel->now >> rotation) << rotation;
+  uint64_t start = base | (slot << shift);
+  return start > wheel->now ? start : wheel->now;
+}
+
+static uint64_t wheelNextEvent(TimerWheel *wheel)
+{
+  uint64_t next = UINT64_MAX;
+  for (uint32_t level = 0; level < kWheelLevels; level++)
+  {
+    // Drop bits of slots emptied by cancellation.
+    uint64_t at = wheelLevelNext(wheel, level);
+    while (at != UINT64_MAX)
+    {
+      uint32_t slot = (uint32_t)(at >> (level * kWheelBits)) & (kWheelSlots - 1);
+      if (!DListEmpty(&wheel->slots[level][slot]))
+      {
+        break;
+      }
+      wheel->occupied[level] &= ~((uint64_t)1 << slot);
+      at = wheelLevelNext(wheel, level);
+    }
+    next = at < next ? at : next;
+  }
+  return next;
+}
+
+// Processes tick t: slots of higher levels that start at t cascade down,
+// then the level 0 slot for t expires.
+static void wheelTick(TimerWheel *wheel, uint64_t t)
+{
+  wheel->now = t;
+  for (uint32_t level = kWheelLevels - 1; level > 0; level--)
+  {
+    uint32_t shift = level * kWheelBits;
+    uint32_t slot = (uint32_t)(t >> shift) & (kWheelSlots - 1);
+    if (!(wheel->occupied[level] & ((uint64_t)1 << slot)))
+    {
+      continue;
+    }
+    assert((t & (((uint64_t)1 << shift) - 1)) == 0);
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    DList *head = &wheel->slots[level][slot];
+    while (!DListEmpty(head))
+    {
+      TimerNode *node = containerOf(head->next, TimerNode, link);
+      DListDetach(&node->link);
+      wheelPlace(wheel, node);
+    }
+  }
+
+  uint32_t slot = (uint32_t)t & (kWheelSlots - 1);
+  wheel->occupied[0] &= ~((uint64_t)1 << slot);
+  DList *head = &wheel->slots[0][slot];
+  while (!DListEmpty(head))
+  {
+    DList *link = head->next;
+    DListDetach(link);
+    DListInsertBefore(&wheel->due, link);
+  }
+  wheel->now = t + 1;
+}
+
+TimerNode *TimerWheelPop(TimerWheel *wheel, uint64_t nowMS)
+{
+  while (DListEmpty(&wheel->due))
+  {
+    uint64_t t = wheelNextEvent(wheel);
+    if (t > nowMS)
+    {
+      // Nothing before nowMS: skip the empty ticks.
+      if (nowMS >= wheel->now)
+      {
+        wheel->now = nowMS + 1;
+      }
+      return NULL;
+    }
+    wheelTick(wheel, t);
+  }
+  TimerNode *node = containerOf(wheel->due.next, TimerNode, link);
+  wheelUnlink(node);
+  wheel->count--;
+  return node;
+}
+
+uint64_t TimerWheelNextMS(const TimerWheel *wheel)
+{
+  if (wheel->due.next != &wheel->due)
+  {
+    return 0;
+  }
+  uint64_t next = UINT64_MAX;
+  for (uint32_t level = 0; level < kWheelLevels; level++)
+  {
+    uint64_t at = wheelLevelNext(wheel, level);
+    next = at < next ? at : next;
+  }
+  return next;
+}
@@ -0,0 +1,327 @@
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include "uring.h"
+
+static int sysSetup(unsigned entries, io_uring_params *params)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sysEnter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argSize)
+{
+  int rv = (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg, argSize);
+  return rv < 0 ? -errno : rv;
+}
+
+static int sysRegister(int fd, unsigned op, void *arg, unsigned n)
+{
+  int rv = (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+  return rv < 0 ? -errno : rv;
+}
+
+static unsigned loadAcquire(unsigned *p)
+{
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned *p, unsigned v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Every opcode the server issues must be known to the running kernel.
+static bool probeOps(int fd)
+{
+  const size_t kProbeOps = 256;
+  size_t size = sizeof(io_uring_probe) + kProbeOps * sizeof(io_uring_probe_op);
+  io_uring_probe *probe = (io_uring_probe *)calloc(1, size);
+  bool ok = sysRegister(fd, IORING_REGISTER_PROBE, probe, kProbeOps) >= 0;
+
+  const uint8_t needed[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_ASYNC_CANCEL};
+  for (uint8_t op : needed)
+  {
+    ok = ok && op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+  }
+  free(probe);
+  return ok;
+}
+
+bool IoUringInit(IoUring *ring, unsigned entries)
+{
+  io_uring_params params = {};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 4;
+  int fd = sysSetup(entries, &params);
+  if (fd < 0)
+  {
+    return false;
+  }
+  ring->fd = fd;
+  ring->features = params.features;
+
+  // EXT_ARG carries the wait timeout; NODROP keeps completions that overflow
+  // the CQ instead of losing them.
+  if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP) || !probeOps(fd))
+  {
+    IoUringClose(ring);
+    return false;
+  }
+
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cqRingSize > ring->sqRingSize)
+    {
+      ring->sqRingSize = ring->cqRingSize;
+    }
+    ring->cqRingSize = ring->sqRingSize;
+  }
+
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED)
+  {
+    ring->sqRing = NULL;
+    IoUringClose(ring);
+    return false;
+  }
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    ring->cqRing = ring->sqRing;
+  }
+  else
+  {
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED)
+    {
+      ring->cqRing = NULL;
+      IoUringClose(ring);
+      return false;
+    }
+  }
+
+  ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes = (io_uring_sqe *)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    ring->sqes = NULL;
+    IoUringClose(ring);
+    return false;
+  }
+
+  uint8_t *sq = (uint8_t *)ring->sqRing;
+  ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+  ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+  ring->sqLocalTail = *ring->sqTail;
+
+  uint8_t *cq = (uint8_t *)ring->cqRing;
+  ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+bool IoUringSetupBuffers(IoUring *ring, uint16_t count, size_t size, uint16_t group)
+{
+  assert(count > 0 && ((count - 1) & count) == 0);
+  ring->bufRingSize = count * sizeof(io_uring_buf);
+  void *mem = mmap(NULL, ring->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+  {
+    return false;
+  }
+  ring->bufRing = (io_uring_buf_ring *)mem;
+
+  io_uring_buf_reg reg = {};
+  reg.ring_addr = (uint64_t)(uintptr_t)mem;
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (sysRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+  {
+    munmap(mem, ring->bufRingSize);
+    ring->bufRing = NULL;
+    return false;
+  }
+
+  ring->bufBase = (uint8_t *)malloc(count * size);
+  ring->bufSize = size;
+  ring->bufCount = count;
+  ring->bufGroup = group;
+  ring->bufTail = 0;
+  for (uint16_t bid = 0; bid < count; bid++)
+  {
+    IoUringRecycleBuffer(ring, bid);
+  }
+  return true;
+}
+
+void IoUringClose(IoUring *ring)
+{
+  if (ring->sqes)
+  {
+    munmap(ring->sqes, ring->sqesSize);
+  }
+  if (ring->cqRing && ring->cqRing != ring->sqRing)
+  {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  if (ring->sqRing)
+  {
+    munmap(ring->sqRing, ring->sqRingSize);
+  }
+  if (ring->bufRing)
+  {
+    munmap(ring->bufRing, ring->bufRingSize);
+  }
+  free(ring->bufBase);
+  if (ring->fd >= 0)
+  {
+    close(ring->fd);
+  }
+  *ring = IoUring{};
+}
+
+io_uring_sqe *IoUringGetSqe(IoUring *ring)
+{
+  unsigned entries = *ring->sqMask + 1;
+  if (ring->sqLocalTail - loadAcquire(ring->sqHead) >= entries)
+  {
+    // Full: hand what we have to the kernel before queueing more.
+    IoUringSubmit(ring);
+    assert(ring->sqLocalTail - loadAcquire(ring->sqHead) < entries);
+  }
+
+  unsigned idx = ring->sqLocalTail & *ring->sqMask;
+  io_uring_sqe *sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sqArray[idx] = idx;
+  ring->sqLocalTail++;
+  ring->toSubmit++;
+  return sqe;
+}
+
+static int enter(IoUring *ring, unsigned wait, unsigned flags, void *arg, size_t argSize)
+{
+  storeRelease(ring->sqTail, ring->sqLocalTail);
+  int rv = sysEnter(ring->fd, ring->toSubmit, wait, flags, arg, argSize);
+  if (rv > 0)
+  {
+    ring->toSubmit -= (unsigned)rv;
+  }
+  return rv;
+}
+
+int IoUringSubmit(IoUring *ring)
+{
+  return enter(ring, 0, 0, NULL, 0);
+}
+
+// One syscall submits everything queued since the last call and waits for
+// at least one completion, or until the timeout expires (-ETIME).
+int IoUringSubmitAndWait(IoUring *ring, int32_t timeoutMS)
+{
+  if (timeoutMS == 0)
+  {
+    return enter(ring, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+  }
+  if (timeoutMS < 0)
+  {
+    return enter(ring, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+  }
+
+  struct __kernel_timespec ts = {};
+  ts.tv_sec = timeoutMS / 1000;
+  ts.tv_nsec = (long long)(timeoutMS % 1000) * 1000 * 1000;
+  io_uring_getevents_arg arg = {};
+  arg.sigmask_sz = _NSIG / 8;
+  arg.ts = (uint64_t)(uintptr_t)&ts;
+  return enter(ring, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+io_uring_cqe *IoUringPeekCqe(IoUring *ring)
+{
+  unsigned head = *ring->cqHead;
+  if (head == loadAcquire(ring->cqTail))
+  {
+    return NULL;
+  }
+  return &ring->cqes[head & *ring->cqMask];
+}
+
+void IoUringCqeSeen(IoUring *ring)
+{
+  storeRelease(ring->cqHead, *ring->cqHead + 1);
+}
+
+uint8_t *IoUringBuffer(IoUring *ring, uint16_t bid)
+{
+  return ring->bufBase + (size_t)bid * ring->bufSize;
+}
+
+void IoUringRecycleBuffer(IoUring *ring, uint16_t bid)
+{
+  // Index the ring as a plain array: in C++ the uapi flexible-array wrapper
+  // gains a one-byte empty member and shifts bufs[] off the kernel layout.
+  io_uring_buf *bufs = (io_uring_buf *)ring->bufRing;
+  io_uring_buf *buf = &bufs[ring->bufTail & (ring->bufCount - 1)];
+  buf->addr = (uint64_t)(uintptr_t)IoUringBuffer(ring, bid);
+  buf->len = (uint32_t)ring->bufSize;
+  buf->bid = bid;
+  ring->bufTail++;
+  __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+void IoUringPrepAcceptMultishot(io_uring_sqe *sqe, int fd)
+{
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+}
+
+void IoUringPrepRecvMultishot(io_uring_sqe *sqe, int fd, uint16_t group)
+{
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+}
+
+void IoUringPrepSendmsg(io_uring_sqe *sqe, int fd, const struct msghdr *msg)
+{
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+// Cancels the operation submitted with userData.
+void IoUringPrepCancel(io_uring_sqe *sqe, uint64_t userData)
+{
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = userData;
+}
+
+void IoUringPrepRead(io_uring_sqe *sqe, int fd, void *buf, size_t len)
+{
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+}
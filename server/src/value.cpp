@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "value.h"
+
+Value *ValueNew(const char *data, size_t len)
+{
+  void *mem = malloc(sizeof(Value) + len);
+  if (!mem)
+  {
+    abort();
+  }
+  Value *value = new (mem) Value();
+  value->len = len;
+  value->cap = len;
+  memcpy(value->data, data, len);
+  return value;
+}
+
+// Overwrites in place when nobody else holds the bytes and they fit without
+// wasting most of the block, otherwise swaps in a new Value.
+Value *ValueAssign(Value *value, const char *data, size_t len)
+{
+  if (value && value->refs.load(std::memory_order_acquire) == 1 &&
+      len <= value->cap && value->cap <= 2 * len + 64)
+  {
+    memcpy(value->data, data, len);
+    value->len = len;
+    return value;
+  }
+  if (value)
+  {
+    ValueRelease(value);
+  }
+  return ValueNew(data, len);
+}
+
+void ValueRelease(Value *value)
+{
+  if (value->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+  {
+    value->~Value();
+    free(value);
+  }
+}
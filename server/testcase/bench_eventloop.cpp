@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <vector>
+#include "eventloop.h"
+
+// Measures the cost of one wakeup with a single ready connection out of N
+// mostly-idle ones. "poll-rebuild" replays the old server loop, which
+// rebuilt the pollfd array from every connection on each iteration.
+//
+// g++ -O2 -std=c++17 -Iserver/include server/testcase/bench_eventloop.cpp server/src/eventloop.cpp
+
+const int kBackendRebuild = -1;
+
+static uint64_t GetMonotonicNSec()
+{
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t raiseFdLimit(size_t want)
+{
+  struct rlimit rl = {};
+  getrlimit(RLIMIT_NOFILE, &rl);
+  if (rl.rlim_cur < want && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = want < rl.rlim_max ? want : rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+  return rl.rlim_cur;
+}
+
+static double benchRebuild(std::vector<int> &fds, std::vector<int> &peers, size_t iters)
+{
+  std::vector<struct pollfd> pollArgs;
+  uint64_t start = GetMonotonicNSec();
+  for (size_t i = 0; i < iters; i++)
+  {
+    size_t pick = (size_t)rand() % fds.size();
+    char c = 'x';
+    ssize_t rv = write(peers[pick], &c, 1);
+    assert(rv == 1);
+
+    pollArgs.clear();
+    for (int fd : fds)
+    {
+      pollArgs.push_back(pollfd{fd, POLLIN | POLLERR, 0});
+    }
+    rv = poll(pollArgs.data(), (nfds_t)pollArgs.size(), -1);
+    assert(rv == 1);
+    for (const struct pollfd &pfd : pollArgs)
+    {
+      if (pfd.revents)
+      {
+        rv = read(pfd.fd, &c, 1);
+        assert(rv == 1);
+      }
+    }
+  }
+  return double(GetMonotonicNSec() - start) / iters;
+}
+
+static double benchLoop(int backend, std::vector<int> &fds, std::vector<int> &peers, size_t iters)
+{
+  EventLoop loop;
+  EventLoopInit(&loop, backend);
+  for (int fd : fds)
+  {
+    EventLoopAdd(&loop, fd, EVENT_READ);
+  }
+
+  uint64_t start = GetMonotonicNSec();
+  for (size_t i = 0; i < iters; i++)
+  {
+    size_t pick = (size_t)rand() % fds.size();
+    char c = 'x';
+    ssize_t rv = write(peers[pick], &c, 1);
+    assert(rv == 1);
+
+    rv = EventLoopWait(&loop, -1);
+    assert(rv == 1);
+    for (const Event &ev : loop.ready)
+    {
+      rv = read(ev.fd, &c, 1);
+      assert(rv == 1);
+    }
+  }
+  double nsec = double(GetMonotonicNSec() - start) / iters;
+
+  for (int fd : fds)
+  {
+    EventLoopDelete(&loop, fd);
+  }
+  EventLoopClose(&loop);
+  return nsec;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<size_t> sizes = {1000, 10000, 50000};
+  if (argc > 1)
+  {
+    sizes.clear();
+    for (int i = 1; i < argc; i++)
+    {
+      sizes.push_back((size_t)atol(argv[i]));
+    }
+  }
+
+  const int backends[] = {kBackendRebuild, EVENT_LOOP_POLL, EVENT_LOOP_EPOLL, EVENT_LOOP_EPOLL_ET};
+  printf("%10s %14s %14s %14s %14s\n", "conns", "poll-rebuild", "poll", "epoll", "epoll-et");
+  size_t prev = 0;
+  for (size_t want : sizes)
+  {
+    size_t limit = raiseFdLimit(2 * want + 64);
+    size_t n = want;
+    if (2 * n + 64 > limit)
+    {
+      n = (limit - 64) / 2;
+      fprintf(stderr, "RLIMIT_NOFILE=%zu, clamping %zu connections to %zu\n", limit, want, n);
+    }
+    if (n == prev)
+    {
+      continue;
+    }
+    prev = n;
+
+    std::vector<int> fds, peers;
+    for (size_t i = 0; i < n; i++)
+    {
+      int sv[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) < 0)
+      {
+        perror("socketpair()");
+        return 1;
+      }
+      fds.push_back(sv[0]);
+      peers.push_back(sv[1]);
+    }
+
+    size_t iters = n < 20000 ? 2000000 / n : 100;
+    printf("%10zu", n);
+    for (int backend : backends)
+    {
+      double nsec = backend == kBackendRebuild
+                        ? benchRebuild(fds, peers, iters)
+                        : benchLoop(backend, fds, peers, iters);
+      printf(" %11.0f ns", nsec);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < n; i++)
+    {
+      close(fds[i]);
+      close(peers[i]);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "hash.h"
+
+// Hashing throughput across key lengths: the 32-bit byte-at-a-time FNV
+// that stringHash used to be, against HashBytes. Also checks how evenly
+// sequential "key:N" names spread over the low and the high bits.
+//
+// g++ -O2 -std=gnu++17 -Iserver/include server/testcase/bench_hash.cpp
+
+static uint64_t GetMonotonicNSec()
+{
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static uint64_t fnvHash(const uint8_t *data, size_t len)
+{
+  uint32_t h = 0x811C9DC5;
+  for (size_t i = 0; i < len; i++)
+  {
+    h = (h + data[i]) * 0x01000193;
+  }
+  return h;
+}
+
+static uint64_t seededHash(const uint8_t *data, size_t len)
+{
+  return HashBytes(data, len, gHashSeed);
+}
+
+static double nsPerHash(uint64_t (*f)(const uint8_t *, size_t), const std::vector<uint8_t> &buf, size_t len)
+{
+  size_t iters = std::max((size_t)100000, (size_t)(200 * 1000 * 1000) / (len + 8));
+  uint64_t sink = 0;
+  uint64_t start = GetMonotonicNSec();
+  for (size_t i = 0; i < iters; i++)
+  {
+    // Vary the start so the hash cannot be hoisted out of the loop.
+    sink += f(buf.data() + (i & 63), len);
+  }
+  double ns = double(GetMonotonicNSec() - start) / iters;
+  if (sink == 42)
+  {
+    printf("\n");
+  }
+  return ns;
+}
+
+// Max bucket load over the mean, for 2^20 buckets picked by low or high bits.
+static double worstBucket(uint64_t (*f)(const uint8_t *, size_t), bool high)
+{
+  const size_t kBuckets = 1 << 20;
+  const size_t kKeys = 4 * kBuckets;
+  std::vector<uint32_t> count(kBuckets);
+  uint32_t worst = 0;
+  for (size_t i = 0; i < kKeys; i++)
+  {
+    std::string key = "key:" + std::to_string(i);
+    uint64_t h = f((const uint8_t *)key.data(), key.size());
+    size_t b = high ? (size_t)(h >> 44) : (size_t)(h & (kBuckets - 1));
+    worst = std::max(worst, ++count[b]);
+  }
+  return double(worst) / (kKeys / kBuckets);
+}
+
+int main()
+{
+  gHashSeed = 0x2545F4914F6CDD1Dull;
+  std::vector<uint8_t> buf(64 + 4096);
+  for (size_t i = 0; i < buf.size(); i++)
+  {
+    buf[i] = (uint8_t)rand();
+  }
+
+  printf("%8s %12s %12s %12s %12s\n", "bytes", "fnv ns", "seeded ns", "fnv GB/s", "seeded GB/s");
+  for (size_t len : {1, 4, 8, 12, 16, 24, 32, 48, 64, 128, 256, 1024, 4096})
+  {
+    double fnv = nsPerHash(&fnvHash, buf, len);
+    double seeded = nsPerHash(&seededHash, buf, len);
+    printf("%8zu %12.2f %12.2f %12.2f %12.2f\n", len, fnv, seeded, len / fnv, len / seeded);
+  }
+
+  printf("\nworst bucket / mean, 4M keys into 1M buckets\n");
+  printf("%-8s %10s %10s\n", "", "low bits", "high bits");
+  printf("%-8s %10.2f %10.2f\n", "fnv", worstBucket(&fnvHash, false), worstBucket(&fnvHash, true));
+  printf("%-8s %10.2f %10.2f\n", "seeded", worstBucket(&seededHash, false), worstBucket(&seededHash, true));
+  return 0;
+}
@@ -0,0 +1,249 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+
+// Pipelined load generator. Sends N requests over one connection with up to
+// `depth` in flight and reports throughput. With the server's pid and the
+// alloc_count.cpp shim preloaded into it, it also reports server-side heap
+// allocations per request.
+//
+// g++ -O2 -std=c++17 -o bench_pipeline server/testcase/bench_pipeline.cpp
+// ./bench_pipeline [-n requests] [-d depth] [-k keys] [-v value-bytes] [-w get|set|mix] [-p server-pid]
+
+static uint64_t GetMonotonicNSec()
+{
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static void die(const char *s)
+{
+  perror(s);
+  exit(1);
+}
+
+static void appendu32(std::string &out, uint32_t v)
+{
+  out.append((const char *)&v, 4);
+}
+
+static void appendRequest(std::string &out, const std::vector<std::string> &cmd)
+{
+  size_t len = 4;
+  for (const std::string &arg : cmd)
+  {
+    len += 4 + arg.size();
+  }
+  appendu32(out, (uint32_t)len);
+  appendu32(out, (uint32_t)cmd.size());
+  for (const std::string &arg : cmd)
+  {
+    appendu32(out, (uint32_t)arg.size());
+    out.append(arg);
+  }
+}
+
+static void sendAll(int fd, const std::string &data)
+{
+  size_t sent = 0;
+  while (sent < data.size())
+  {
+    ssize_t rv = write(fd, data.data() + sent, data.size() - sent);
+    if (rv <= 0)
+    {
+      die("write()");
+    }
+    sent += (size_t)rv;
+  }
+}
+
+// Reads until n complete responses have arrived.
+static void readResponses(int fd, size_t n, std::string &pending)
+{
+  char buf[64 * 1024];
+  while (n > 0)
+  {
+    size_t pos = 0;
+    while (n > 0 && pending.size() - pos >= 4)
+    {
+      uint32_t len = 0;
+      memcpy(&len, pending.data() + pos, 4);
+      if (pending.size() - pos < 4 + len)
+      {
+        break;
+      }
+      pos += 4 + len;
+      n--;
+    }
+    pending.erase(0, pos);
+    if (n == 0)
+    {
+      break;
+    }
+
+    ssize_t rv = read(fd, buf, sizeof(buf));
+    if (rv <= 0)
+    {
+      die("read()");
+    }
+    pending.append(buf, (size_t)rv);
+  }
+}
+
+static uint64_t serverAllocs(pid_t pid)
+{
+  const char *path = getenv("ALLOC_COUNT_FILE");
+  if (pid <= 0 || !path)
+  {
+    return 0;
+  }
+  unlink(path);
+  kill(pid, SIGUSR1);
+  for (int i = 0; i < 100; i++)
+  {
+    FILE *f = fopen(path, "r");
+    if (f)
+    {
+      unsigned long long n = 0;
+      int ok = fscanf(f, "%llu", &n);
+      fclose(f);
+      if (ok == 1)
+      {
+        return n;
+      }
+    }
+    usleep(10 * 1000);
+  }
+  fprintf(stderr, "no allocation count from pid %d\n", (int)pid);
+  return 0;
+}
+
+static std::string makeValue(size_t i, size_t valueSize)
+{
+  std::string value = "value:" + std::to_string(i);
+  if (valueSize > value.size())
+  {
+    value.resize(valueSize, 'v');
+  }
+  return value;
+}
+
+static std::vector<std::string> makeCmd(const std::string &workload, size_t i, size_t keys, size_t valueSize)
+{
+  std::string key = "key:" + std::to_string(i % keys);
+  bool set = workload == "set" || (workload == "mix" && i % 2 == 0);
+  if (set)
+  {
+    return {"set", key, makeValue(i % keys, valueSize)};
+  }
+  return {"get", key};
+}
+
+int main(int argc, char **argv)
+{
+  size_t total = 1000 * 1000;
+  size_t depth = 1000;
+  size_t keys = 10000;
+  size_t valueSize = 0;
+  std::string workload = "mix";
+  pid_t pid = 0;
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "n:d:k:v:w:p:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      total = (size_t)atol(optarg);
+      break;
+    case 'd':
+      depth = (size_t)atol(optarg);
+      break;
+    case 'k':
+      keys = (size_t)atol(optarg);
+      break;
+    case 'v':
+      valueSize = (size_t)atol(optarg);
+      break;
+    case 'w':
+      workload = optarg;
+      break;
+    case 'p':
+      pid = (pid_t)atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n requests] [-d depth] [-k keys] [-v value-bytes] [-w get|set|mix] [-p server-pid]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(1234);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || connect(fd, (const sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    die("connect()");
+  }
+  int val = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+
+  // Populate every key first so the measured run is steady state.
+  std::string batch, pending;
+  for (size_t i = 0; i < keys; i++)
+  {
+    appendRequest(batch, {"set", "key:" + std::to_string(i), makeValue(i, valueSize)});
+    if ((i + 1) % depth == 0 || i + 1 == keys)
+    {
+      sendAll(fd, batch);
+      readResponses(fd, (i % depth) + 1, pending);
+      batch.clear();
+    }
+  }
+
+  // Encode everything up front so the client costs little during the run.
+  std::vector<std::string> batches;
+  for (size_t i = 0; i < total; i += depth)
+  {
+    std::string out;
+    for (size_t j = i; j < total && j < i + depth; j++)
+    {
+      appendRequest(out, makeCmd(workload, j, keys, valueSize));
+    }
+    batches.push_back(out);
+  }
+
+  uint64_t allocsBefore = serverAllocs(pid);
+  uint64_t start = GetMonotonicNSec();
+  size_t done = 0;
+  for (const std::string &out : batches)
+  {
+    size_t n = std::min(depth, total - done);
+    sendAll(fd, out);
+    readResponses(fd, n, pending);
+    done += n;
+  }
+  double sec = double(GetMonotonicNSec() - start) / 1e9;
+  uint64_t allocsAfter = serverAllocs(pid);
+
+  printf("%s: %zu requests, depth %zu, %.3f s, %.0f req/s\n", workload.c_str(), total, depth, sec, total / sec);
+  if (pid > 0)
+  {
+    printf("server allocations: %llu, %.2f per request\n",
+           (unsigned long long)(allocsAfter - allocsBefore),
+           double(allocsAfter - allocsBefore) / total);
+  }
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "common.h"
+#include "heap.h"
+#include "timerwheel.h"
+
+// Key-expiry timers: the binary heap the server used to keep TTLs in,
+// against the timing wheel. N entries get a TTL, are each rescheduled once
+// (as a repeated PEXPIRE does), then time advances until all expire, popping
+// at most `budget` timers per 1 ms tick like the server loop.
+//
+// g++ -O2 -std=gnu++17 -Iserver/include server/testcase/bench_timers.cpp server/src/heap.cpp server/src/timerwheel.cpp
+// ./a.out [entries] [max-ttl-ms] [budget]
+
+static uint64_t GetMonotonicNSec()
+{
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+struct HeapEntry
+{
+  size_t heapIndex = -1;
+  uint64_t pad[4] = {};
+};
+
+struct WheelEntry
+{
+  TimerNode timer;
+  uint64_t pad[4] = {};
+};
+
+struct Result
+{
+  double insertNs = 0;
+  double rescheduleNs = 0;
+  double expireNs = 0;
+};
+
+static void heapUpsert(std::vector<HeapItem> &heap, HeapEntry *entry, uint64_t expireAt)
+{
+  size_t pos = entry->heapIndex;
+  if (pos < heap.size())
+  {
+    heap[pos].val = expireAt;
+  }
+  else
+  {
+    pos = heap.size();
+    heap.push_back({expireAt, &entry->heapIndex});
+  }
+  HeapUpdate(heap.data(), pos, heap.size());
+}
+
+static void heapPopFront(std::vector<HeapItem> &heap)
+{
+  *heap[0].ref = -1;
+  heap[0] = heap.back();
+  heap.pop_back();
+  if (!heap.empty())
+  {
+    HeapUpdate(heap.data(), 0, heap.size());
+  }
+}
+
+static Result benchHeap(const std::vector<uint64_t> &ttl, const std::vector<uint64_t> &ttl2, size_t budget)
+{
+  size_t n = ttl.size();
+  std::vector<HeapEntry> entries(n);
+  std::vector<HeapItem> heap;
+  Result r;
+
+  uint64_t start = GetMonotonicNSec();
+  for (size_t i = 0; i < n; i++)
+  {
+    heapUpsert(heap, &entries[i], ttl[i]);
+  }
+  r.insertNs = double(GetMonotonicNSec() - start) / n;
+
+  start = GetMonotonicNSec();
+  for (size_t i = 0; i < n; i++)
+  {
+    heapUpsert(heap, &entries[i], ttl2[i]);
+  }
+  r.rescheduleNs = double(GetMonotonicNSec() - start) / n;
+
+  start = GetMonotonicNSec();
+  size_t expired = 0;
+  for (uint64_t nowMS = 0; !heap.empty(); nowMS++)
+  {
+    for (size_t work = 0; work < budget && !heap.empty() && heap[0].val <= nowMS; work++)
+    {
+      heapPopFront(heap);
+      expired++;
+    }
+  }
+  r.expireNs = double(GetMonotonicNSec() - start) / n;
+  assert(expired == n);
+  return r;
+}
+
+static Result benchWheel(const std::vector<uint64_t> &ttl, const std::vector<uint64_t> &ttl2, size_t budget)
+{
+  size_t n = ttl.size();
+  std::vector<WheelEntry> entries(n);
+  TimerWheel *wheel = new TimerWheel();
+  TimerWheelInit(wheel, 0);
+  Result r;
+
+  uint64_t start = GetMonotonicNSec();
+  for (size_t i = 0; i < n; i++)
+  {
+    TimerWheelAdd(wheel, &entries[i].timer, ttl[i]);
+  }
+  r.insertNs = double(GetMonotonicNSec() - start) / n;
+
+  start = GetMonotonicNSec();
+  for (size_t i = 0; i < n; i++)
+  {
+    TimerWheelAdd(wheel, &entries[i].timer, ttl2[i]);
+  }
+  r.rescheduleNs = double(GetMonotonicNSec() - start) / n;
+
+  start = GetMonotonicNSec();
+  size_t expired = 0;
+  for (uint64_t nowMS = 0; wheel->count > 0; nowMS++)
+  {
+    for (size_t work = 0; work < budget && TimerWheelPop(wheel, nowMS); work++)
+    {
+      expired++;
+    }
+  }
+  r.expireNs = double(GetMonotonicNSec() - start) / n;
+  assert(expired == n);
+  delete wheel;
+  return r;
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? (size_t)atol(argv[1]) : 10 * 1000 * 1000;
+  uint64_t maxTTL = argc > 2 ? (uint64_t)atol(argv[2]) : 3600 * 1000;
+  size_t budget = argc > 3 ? (size_t)atol(argv[3]) : 2000;
+
+  std::vector<uint64_t> ttl(n), ttl2(n);
+  for (size_t i = 0; i < n; i++)
+  {
+    ttl[i] = 1 + ((uint64_t)rand() * 7919) % maxTTL;
+    ttl2[i] = 1 + ((uint64_t)rand() * 7919) % maxTTL;
+  }
+
+  printf("%zu timers, ttl up to %llu ms, budget %zu per tick\n", n, (unsigned long long)maxTTL, budget);
+  printf("%-6s %12s %12s %12s\n", "", "insert ns", "resched ns", "expire ns");
+  Result heap = benchHeap(ttl, ttl2, budget);
+  printf("%-6s %12.1f %12.1f %12.1f\n", "heap", heap.insertNs, heap.rescheduleNs, heap.expireNs);
+  Result wheel = benchWheel(ttl, ttl2, budget);
+  printf("%-6s %12.1f %12.1f %12.1f\n", "wheel", wheel.insertNs, wheel.rescheduleNs, wheel.expireNs);
+  return 0;
+}
@@ -0,0 +1,256 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "hashtable.h"
+
+// Randomized insert/lookup/delete against std::unordered_map, for each
+// HMap engine, across many incremental resizes. Then grows a map to 200k
+// keys, deletes nearly all of them and checks that the table shrank and
+// that background migration completes it, and scans while it resizes.
+//
+// g++ -O2 -std=gnu++17 -Iserver/include server/testcase/test_hashtable.cpp server/src/hashtable.cpp server/src/swisstable.cpp
+
+struct Data
+{
+  HNode node;
+  uint64_t key = 0;
+};
+
+static bool dataEqual(HNode *a, HNode *b)
+{
+  return containerOf(a, Data, node)->key == containerOf(b, Data, node)->key;
+}
+
+// A deliberately weak hash so that engines cope with clustered hcodes.
+static uint64_t keyHash(uint64_t key)
+{
+  return key % 1000003;
+}
+
+static Data *find(HMap *hmap, uint64_t key)
+{
+  Data probe;
+  probe.key = key;
+  probe.node.hcode = keyHash(key);
+  HNode *node = HashMapLookup(hmap, &probe.node, &dataEqual);
+  return node ? containerOf(node, Data, node) : NULL;
+}
+
+static bool countNode(HNode *, void *arg)
+{
+  (*(size_t *)arg)++;
+  return true;
+}
+
+static void verify(HMap *hmap, std::unordered_map<uint64_t, Data *> &ref)
+{
+  assert(HashMapSize(hmap) == ref.size());
+  size_t count = 0;
+  HashMapForEach(hmap, &countNode, &count);
+  assert(count == ref.size());
+  for (auto &[key, data] : ref)
+  {
+    assert(find(hmap, key) == data);
+  }
+}
+
+static void run(uint32_t engine)
+{
+  HMap hmap;
+  hmap.engine = engine;
+  std::unordered_map<uint64_t, Data *> ref;
+
+  for (size_t round = 0; round < 200000; round++)
+  {
+    uint64_t key = (uint64_t)rand() % (round < 100000 ? 50000 : 5000);
+    auto it = ref.find(key);
+    if (rand() % 3 == 0 && it != ref.end())
+    {
+      Data probe;
+      probe.key = key;
+      probe.node.hcode = keyHash(key);
+      HNode *node = HashMapDelete(&hmap, &probe.node, &dataEqual);
+      assert(node == &it->second->node);
+      delete it->second;
+      ref.erase(it);
+    }
+    else if (it == ref.end())
+    {
+      assert(!find(&hmap, key));
+      Data *data = new Data();
+      data->key = key;
+      data->node.hcode = keyHash(key);
+      HashMapInsert(&hmap, &data->node);
+      ref[key] = data;
+    }
+    else
+    {
+      assert(find(&hmap, key) == it->second);
+    }
+    if (round % 20000 == 0)
+    {
+      verify(&hmap, ref);
+    }
+  }
+  verify(&hmap, ref);
+
+  HashMapClear(&hmap);
+  assert(hmap.engine == engine && HashMapSize(&hmap) == 0 && !HashMapRehashPending());
+  for (auto &[key, data] : ref)
+  {
+    delete data;
+  }
+}
+
+static size_t capacity(HMap *hmap)
+{
+  return hmap->newer.mask + 1 + (hmap->older.bucket ? hmap->older.mask + 1 : 0);
+}
+
+static void shrink(uint32_t engine)
+{
+  HMap hmap;
+  hmap.engine = engine;
+  std::unordered_map<uint64_t, Data *> ref;
+  const size_t kKeys = 200000;
+  for (uint64_t key = 0; key < kKeys; key++)
+  {
+    Data *data = new Data();
+    data->key = key;
+    data->node.hcode = keyHash(key);
+    HashMapInsert(&hmap, &data->node);
+    ref[key] = data;
+  }
+  size_t peak = capacity(&hmap);
+
+  // Interleave a few inserts so that some land while a shrink is migrating.
+  for (uint64_t key = 0; key < kKeys - 100; key++)
+  {
+    Data probe;
+    probe.key = key;
+    probe.node.hcode = keyHash(key);
+    HNode *node = HashMapDelete(&hmap, &probe.node, &dataEqual);
+    assert(node == &ref[key]->node);
+    delete ref[key];
+    ref.erase(key);
+    if (key % 1024 == 0)
+    {
+      Data *data = new Data();
+      data->key = kKeys + key;
+      data->node.hcode = keyHash(data->key);
+      HashMapInsert(&hmap, &data->node);
+      ref[data->key] = data;
+    }
+  }
+  verify(&hmap, ref);
+  assert(capacity(&hmap) * 16 < peak);
+
+  // Whatever is left of the last resize finishes in the background.
+  while (HashMapRehashBackground(1000) == 1000)
+  {
+  }
+  assert(!HashMapRehashPending() && !hmap.older.bucket);
+  verify(&hmap, ref);
+
+  HashMapClear(&hmap);
+  for (auto &[key, data] : ref)
+  {
+    delete data;
+  }
+}
+
+static void markSeen(HNode *node, void *arg)
+{
+  (*(std::unordered_map<uint64_t, size_t> *)arg)[containerOf(node, Data, node)->key]++;
+}
+
+// Scans while the map grows and shrinks between calls. Keys below kStable
+// stay throughout and must each be seen; the others come and go.
+static void scan(uint32_t engine)
+{
+  HMap hmap;
+  hmap.engine = engine;
+  std::unordered_map<uint64_t, Data *> ref;
+  auto add = [&](uint64_t key)
+  {
+    Data *data = new Data();
+    data->key = key;
+    data->node.hcode = keyHash(key);
+    HashMapInsert(&hmap, &data->node);
+    ref[key] = data;
+  };
+  auto remove = [&](uint64_t key)
+  {
+    Data probe;
+    probe.key = key;
+    probe.node.hcode = keyHash(key);
+    HashMapDelete(&hmap, &probe.node, &dataEqual);
+    delete ref[key];
+    ref.erase(key);
+  };
+
+  const uint64_t kStable = 3000;
+  for (uint64_t key = 0; key < kStable; key++)
+  {
+    add(key);
+  }
+  for (int pass = 0; pass < 4; pass++)
+  {
+    std::unordered_map<uint64_t, size_t> seen;
+    uint64_t cursor = 0;
+    uint64_t extra = 0;
+    size_t calls = 0;
+    do
+    {
+      cursor = HashMapScan(&hmap, cursor, &markSeen, &seen);
+      calls++;
+      // Grow by 40k keys, then drop them again, so that both directions
+      // of resize happen mid-scan.
+      for (int i = 0; i < 40; i++)
+      {
+        if ((calls / 1000) % 2 == 0)
+        {
+          add(1000000 + extra++);
+        }
+        else if (extra > 0)
+        {
+          remove(1000000 + --extra);
+        }
+      }
+    } while (cursor != 0);
+    for (uint64_t key = 0; key < kStable; key++)
+    {
+      assert(seen.count(key));
+    }
+    for (auto &[key, n] : seen)
+    {
+      assert(n <= 2);
+    }
+    while (extra > 0)
+    {
+      remove(1000000 + --extra);
+    }
+  }
+  verify(&hmap, ref);
+
+  HashMapClear(&hmap);
+  for (auto &[key, data] : ref)
+  {
+    delete data;
+  }
+}
+
+int main()
+{
+  run(HMAP_CHAINED);
+  run(HMAP_SWISS);
+  shrink(HMAP_CHAINED);
+  shrink(HMAP_SWISS);
+  scan(HMAP_CHAINED);
+  scan(HMAP_SWISS);
+  printf("hashtable ok\n");
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+#include "common.h"
+#include "timerwheel.h"
+
+// Randomized check of the timing wheel against a std::multimap of
+// deadlines: every timer fires once, never early, and none is left behind.
+//
+// g++ -O2 -std=gnu++17 -Iserver/include server/testcase/test_timerwheel.cpp server/src/timerwheel.cpp
+
+struct Timer
+{
+  TimerNode node;
+  uint32_t id = 0;
+};
+
+static uint64_t randomDelay()
+{
+  switch (rand() % 4)
+  {
+  case 0:
+    return (uint64_t)(rand() % 100);
+  case 1:
+    return (uint64_t)(rand() % 100000);
+  case 2:
+    return (uint64_t)rand() * 1000;
+  default:
+    return (uint64_t)rand() << 10;
+  }
+}
+
+static void drain(TimerWheel &wheel, std::multimap<uint64_t, uint32_t> &ref,
+                  std::vector<Timer> &timers, uint64_t nowMS)
+{
+  while (TimerNode *node = TimerWheelPop(&wheel, nowMS))
+  {
+    Timer *timer = containerOf(node, Timer, node);
+    assert(node->expireAt <= nowMS);
+    assert(!TimerArmed(node));
+    auto range = ref.equal_range(node->expireAt);
+    auto it = range.first;
+    while (it != range.second && it->second != timer->id)
+    {
+      it++;
+    }
+    assert(it != range.second);
+    ref.erase(it);
+  }
+  assert(ref.empty() || ref.begin()->first > nowMS);
+  assert(wheel.count == ref.size());
+  assert(TimerWheelNextMS(&wheel) > nowMS || wheel.count == 0);
+  if (!ref.empty())
+  {
+    assert(TimerWheelNextMS(&wheel) <= ref.begin()->first);
+  }
+}
+
+static void cancel(std::multimap<uint64_t, uint32_t> &ref, Timer &timer)
+{
+  auto range = ref.equal_range(timer.node.expireAt);
+  for (auto it = range.first; it != range.second; it++)
+  {
+    if (it->second == timer.id)
+    {
+      ref.erase(it);
+      return;
+    }
+  }
+  assert(!"timer not found");
+}
+
+int main()
+{
+  const size_t kTimers = 20000;
+  for (uint64_t start : {(uint64_t)0, (uint64_t)123456789, ((uint64_t)1 << 36) - 5})
+  {
+    TimerWheel wheel;
+    TimerWheelInit(&wheel, start);
+    std::multimap<uint64_t, uint32_t> ref;
+    std::vector<Timer> timers(kTimers);
+    uint64_t nowMS = start;
+    for (uint32_t i = 0; i < kTimers; i++)
+    {
+      timers[i].id = i;
+    }
+
+    for (size_t round = 0; round < 2000; round++)
+    {
+      for (size_t op = 0; op < 50; op++)
+      {
+        Timer &timer = timers[(size_t)rand() % kTimers];
+        if (TimerArmed(&timer.node))
+        {
+          cancel(ref, timer);
+        }
+        if (rand() % 5 == 0)
+        {
+          TimerWheelCancel(&wheel, &timer.node);
+          continue;
+        }
+        // Deadlines in the past fire on the next pop.
+        uint64_t expireAt = rand() % 20 == 0 ? nowMS - (nowMS ? 1 : 0) : nowMS + randomDelay();
+        TimerWheelAdd(&wheel, &timer.node, expireAt);
+        ref.insert({expireAt, timer.id});
+      }
+      uint64_t step = rand() % 10 == 0 ? randomDelay() : (uint64_t)(rand() % 200);
+      nowMS += step;
+      drain(wheel, ref, timers, nowMS);
+    }
+
+    nowMS = UINT64_MAX - 1;
+    drain(wheel, ref, timers, nowMS);
+    assert(wheel.count == 0);
+  }
+  printf("timer wheel ok\n");
+  return 0;
+}